@@ -17,6 +17,13 @@
 #include "handycpp/time.h"
 #include "handycpp/human_readable.h"
 #include "handycpp/event_loop.h"
+#include "handycpp/event_loop_pool.h"
+#include "handycpp/parallel.h"
+#include "handycpp/task_graph.h"
+#include "handycpp/future.h"
+#include "handycpp/sharded_executor.h"
+#include "handycpp/batch_collector.h"
+#include "handycpp/coroutine.h"
 #include "handycpp/signal_slot.h"
 
 #endif // HANDYCPP_ALL_H
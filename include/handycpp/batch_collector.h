@@ -0,0 +1,248 @@
+//
+// Created by zhangfuwen on 2026/10/17.
+//
+
+#ifndef HANDYCPP_BATCH_COLLECTOR_H
+#define HANDYCPP_BATCH_COLLECTOR_H
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "handycpp/event_loop.h"
+
+/**
+ * collects items from any number of threads and hands them to a flush callback on an EventLoop in batches.
+ *
+ * a batch is flushed as soon as it holds batchSize items, or maxDelay after its first item arrived, whichever comes
+ * first, so a trickle of items still gets out in time while a burst is handled in a few large calls. add() never
+ * takes a lock: items go through a lock-free queue and an atomic counter decides when a flush is due. the flush
+ * callback always runs on the loop thread and gets everything that arrived up to that point, which may be more than
+ * batchSize.
+ *
+ * the destructor flushes what is left, waiting for the loop if it has to. its flush, like the ones add() schedules, is
+ * queued even when a bounded loop is full. no thread may call add() once it started.
+ *
+ * @example
+ * \code{.cpp}
+ * handycpp::BatchCollector<LogLine> writer(ioLoop, 256, std::chrono::milliseconds(5),
+ *     [fd](std::vector<LogLine> &lines) { writeAll(fd, lines); });
+ * writer.add(LogLine{...}); // from any thread
+ * \endcode
+ */
+namespace handycpp {
+
+template <typename T> class BatchCollector {
+public:
+    using flush_t = MoveOnlyFunction<void(std::vector<T> &)>;
+
+    BatchCollector(EventLoop &loop, size_t batchSize, std::chrono::nanoseconds maxDelay, flush_t &&flush)
+        : m_loop(loop), m_state(std::make_shared<State>(std::max<size_t>(batchSize, 1), maxDelay, std::move(flush))) {}
+    BatchCollector(const BatchCollector &) = delete;
+    BatchCollector &operator=(const BatchCollector &) = delete;
+    ~BatchCollector() {
+        auto last = [this] {
+            flushNow(m_loop, m_state);
+            m_state->closed = true; // deadlines still in flight keep the state alive, but do nothing
+        };
+        if (m_loop.onLoopThread()) {
+            last();
+            return;
+        }
+        // forced, so a full bounded loop can neither refuse the last flush nor make enqueueSync throw from here
+        handycpp::runSync([this](EventLoop::callable_t &&task) { m_loop.enqueueForced(std::move(task)); }, last);
+    }
+
+    /**
+     * may throw std::bad_alloc when the queue has to grow, the item is then not collected
+     */
+    void add(T item) {
+        // counted before it is visible, so a flush never subtracts an item that was not counted
+        size_t queued = m_state->count.fetch_add(1, std::memory_order_acq_rel) + 1;
+        try {
+            m_state->queue.push(std::move(item));
+        } catch (...) {
+            m_state->count.fetch_sub(1, std::memory_order_acq_rel);
+            throw;
+        }
+        if (queued == 1) {
+            armDeadline(m_loop, m_state);
+        }
+        if (queued >= m_state->batchSize) {
+            scheduleFlush(m_loop, m_state);
+        }
+    }
+
+    /**
+     * flushes whatever has been collected without waiting for the batch to fill up
+     */
+    void flush() {
+        m_loop.enqueue([&loop = m_loop, state = m_state] { flushNow(loop, state); });
+    }
+
+private:
+    struct State {
+        State(size_t batchSize, std::chrono::nanoseconds maxDelay, flush_t &&callback)
+            : batchSize(batchSize), maxDelay(maxDelay), callback(std::move(callback)) {}
+
+        const size_t batchSize;
+        const std::chrono::nanoseconds maxDelay;
+        flush_t callback;
+        MpscQueue<T> queue;
+        std::atomic<size_t> count{0};
+        std::atomic<bool> flushScheduled{false};
+        std::atomic<uint64_t> generation{0}; // bumped by every flush, so a deadline only flushes its own batch
+        std::vector<T> batch;                // reused between flushes, loop thread only
+        bool closed = false;                 // loop thread only
+    };
+
+    static void scheduleFlush(EventLoop &loop, const std::shared_ptr<State> &state) {
+        if (!state->flushScheduled.exchange(true, std::memory_order_acq_rel)) {
+            // forced like the deadline timers: at most one is in flight, and a dropped one would leave flushScheduled set
+            loop.enqueueForced([&loop, state] { flushNow(loop, state); });
+        }
+    }
+
+    static void armDeadline(EventLoop &loop, const std::shared_ptr<State> &state) {
+        uint64_t generation = state->generation.load(std::memory_order_acquire);
+        loop.enqueueAfter(state->maxDelay, [&loop, state, generation] {
+            if (state->generation.load(std::memory_order_relaxed) == generation) {
+                flushNow(loop, state);
+            }
+        });
+    }
+
+    // loop thread only
+    static void flushNow(EventLoop &loop, const std::shared_ptr<State> &state) {
+        if (state->closed) {
+            return;
+        }
+        state->generation.fetch_add(1, std::memory_order_acq_rel);
+        auto &batch = state->batch;
+        batch.clear();
+        auto append = [&batch](T &&item) { batch.push_back(std::move(item)); };
+        while (state->queue.popInto(append)) {
+        }
+        size_t left = state->count.fetch_sub(batch.size(), std::memory_order_acq_rel) - batch.size();
+        state->flushScheduled.store(false, std::memory_order_release);
+        if (!batch.empty()) {
+            state->callback(batch);
+        }
+        // items counted but still being pushed when we looked start the next batch, nobody else arms its deadline
+        if (left >= state->batchSize) {
+            scheduleFlush(loop, state);
+        } else if (left > 0) {
+            armDeadline(loop, state);
+        }
+    }
+
+    EventLoop &m_loop;
+    std::shared_ptr<State> m_state;
+};
+
+} // namespace handycpp
+
+#ifdef HANDYCPP_TEST
+#include <future>
+#include <string>
+#include <thread>
+#include "doctest/doctest.h"
+
+TEST_CASE("handycpp::batch_collector") {
+    EventLoop loop;
+    std::vector<size_t> batches;
+    size_t total = 0;
+    std::thread::id flushedOn;
+
+    {
+        handycpp::BatchCollector<int> collector(loop, 100, std::chrono::seconds(10), [&](std::vector<int> &batch) {
+            flushedOn = std::this_thread::get_id();
+            batches.push_back(batch.size());
+            total += batch.size();
+        });
+
+        // size triggered: 4 threads x 1000 items, batches of at least 100 apart from the final one
+        std::vector<std::thread> producers;
+        for (int p = 0; p < 4; p++) {
+            producers.emplace_back([&] {
+                for (int i = 0; i < 1000; i++) {
+                    collector.add(i);
+                }
+            });
+        }
+        for (auto &producer : producers) {
+            producer.join();
+        }
+    }
+    CHECK_EQ(total, 4000u);
+    CHECK_LE(batches.size(), 50u); // a flush may find a few items counted but not pushed yet
+    CHECK_EQ(flushedOn, loop.enqueueSync([] { return std::this_thread::get_id(); }));
+
+    // deadline triggered: a trickle never reaches the batch size but still gets out in time
+    std::atomic<size_t> flushed{0};
+    handycpp::BatchCollector<std::string> trickle(
+        loop, 1000, std::chrono::milliseconds(20), [&](std::vector<std::string> &batch) { flushed += batch.size(); });
+    trickle.add("a");
+    trickle.add("b");
+    CHECK_EQ(flushed.load(), 0u);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (flushed.load() < 2 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_EQ(flushed.load(), 2u);
+
+    // items need not be default constructible
+    struct Reading {
+        explicit Reading(int value) : value(value) {}
+        int value;
+    };
+    int sum = 0;
+    {
+        handycpp::BatchCollector<Reading> readings(loop, 2, std::chrono::seconds(10), [&](std::vector<Reading> &batch) {
+            for (auto &reading : batch) {
+                sum += reading.value;
+            }
+        });
+        readings.add(Reading(1));
+        readings.add(Reading(2));
+        readings.add(Reading(3));
+    }
+    CHECK_EQ(sum, 6);
+
+    // a full bounded loop still takes the final flush
+    EventLoop::Options options;
+    options.capacity = 1;
+    options.overflow = EventLoop::Overflow::Fail;
+    EventLoop bounded(options);
+    std::promise<void> started;
+    std::promise<void> gate;
+    bounded.enqueue([&started, opened = gate.get_future().share()] {
+        started.set_value();
+        opened.wait();
+    });
+    started.get_future().wait();
+    sum = 0;
+    auto last = std::make_unique<handycpp::BatchCollector<Reading>>(
+        bounded, 100, std::chrono::seconds(10), [&](std::vector<Reading> &batch) {
+            for (auto &reading : batch) {
+                sum += reading.value;
+            }
+        });
+    last->add(Reading(4)); // hands its deadline to the loop, which fills it
+    last->add(Reading(5));
+    CHECK_FALSE(bounded.tryEnqueue([] {}));
+    std::thread destroyer([&last] { last = nullptr; });
+    while (bounded.stats().queueDepth < 2) {
+        std::this_thread::yield();
+    }
+    gate.set_value();
+    destroyer.join();
+    CHECK_EQ(sum, 9);
+}
+#endif
+
+#endif // HANDYCPP_BATCH_COLLECTOR_H
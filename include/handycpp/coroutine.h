@@ -0,0 +1,290 @@
+//
+// Created by zhangfuwen on 2026/10/17.
+//
+
+#ifndef HANDYCPP_COROUTINE_H
+#define HANDYCPP_COROUTINE_H
+
+#include "handycpp/event_loop.h"
+
+#if defined(HANDYCPP_HAS_COROUTINES)
+#include <coroutine>
+#include <exception>
+#include <future>
+#include <optional>
+#include <type_traits>
+#include <utility>
+
+/**
+ * C++20 coroutines on top of EventLoop, only available when the compiler supports them.
+ *
+ * task<T> is lazy: it starts when it is co_awaited, and when it finishes it resumes its awaiter directly on the thread
+ * it finished on, no thread is blocked and no std::future is created along the way. use EventLoop::schedule() to hop
+ * between loops, async_on() to run a plain callable on another loop, spawn() to start a flow from non-coroutine code
+ * and sync_wait() to block on a task.
+ *
+ * @example
+ * \code{.cpp}
+ * handycpp::task<int> lookup(EventLoop &db, int key) {
+ *     int value = co_await handycpp::async_on(db, [key] { return table[key]; });
+ *     co_return value * 2; // back on the loop that awaited
+ * }
+ *
+ * handycpp::task<> session(EventLoop &io, EventLoop &db) {
+ *     int v = co_await lookup(db, 42);
+ *     send(v);
+ * }
+ *
+ * handycpp::spawn(io, session(io, db));
+ * \endcode
+ */
+namespace handycpp {
+
+template <typename T = void> class task;
+
+namespace detail {
+
+struct task_promise_base {
+    struct final_awaiter {
+        bool await_ready() const noexcept { return false; }
+        template <typename Promise> std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> h) noexcept {
+            return h.promise().continuation;
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    final_awaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr exception;
+};
+
+template <typename T> struct task_promise : task_promise_base {
+    task<T> get_return_object() noexcept;
+    template <typename U> void return_value(U &&v) { value.emplace(std::forward<U>(v)); }
+    T result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+        return std::move(*value);
+    }
+    std::optional<T> value;
+};
+
+template <> struct task_promise<void> : task_promise_base {
+    task<void> get_return_object() noexcept;
+    void return_void() const noexcept {}
+    void result() {
+        if (exception) {
+            std::rethrow_exception(exception);
+        }
+    }
+};
+
+// fire-and-forget coroutine used to bridge into task<T> from ordinary code
+struct detached_task {
+    struct promise_type {
+        detached_task get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+} // namespace detail
+
+template <typename T> class task {
+public:
+    using promise_type = detail::task_promise<T>;
+
+    task() noexcept = default;
+    explicit task(std::coroutine_handle<promise_type> handle) noexcept : m_handle(handle) {}
+    task(task &&other) noexcept : m_handle(std::exchange(other.m_handle, nullptr)) {}
+    task(const task &) = delete;
+    ~task() {
+        if (m_handle) {
+            m_handle.destroy();
+        }
+    }
+
+    task &operator=(task &&other) noexcept {
+        if (this != &other) {
+            if (m_handle) {
+                m_handle.destroy();
+            }
+            m_handle = std::exchange(other.m_handle, nullptr);
+        }
+        return *this;
+    }
+    task &operator=(const task &) = delete;
+
+    auto operator co_await() && noexcept {
+        struct Awaiter {
+            std::coroutine_handle<promise_type> handle;
+            bool await_ready() const noexcept { return !handle || handle.done(); }
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+                handle.promise().continuation = awaiting;
+                return handle;
+            }
+            T await_resume() { return handle.promise().result(); }
+        };
+        return Awaiter{m_handle};
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace detail {
+template <typename T> task<T> task_promise<T>::get_return_object() noexcept {
+    return task<T>(std::coroutine_handle<task_promise<T>>::from_promise(*this));
+}
+inline task<void> task_promise<void>::get_return_object() noexcept {
+    return task<void>(std::coroutine_handle<task_promise<void>>::from_promise(*this));
+}
+
+inline detached_task spawn_on(EventLoop &loop, task<void> t) {
+    co_await loop.schedule();
+    co_await std::move(t);
+}
+
+template <typename T> detached_task fulfil(task<T> t, std::promise<T> &promise) {
+    try {
+        if constexpr (std::is_void_v<T>) {
+            co_await std::move(t);
+            promise.set_value();
+        } else {
+            promise.set_value(co_await std::move(t));
+        }
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+} // namespace detail
+
+/**
+ * starts t on loop's thread and returns immediately, the task frees itself when it finishes.
+ * an exception escaping t terminates the program.
+ */
+inline void spawn(EventLoop &loop, task<void> t) { detail::spawn_on(loop, std::move(t)); }
+
+/**
+ * runs t on the calling thread until its first suspension and blocks until it finishes.
+ * must not be called from the loop thread the task needs to make progress.
+ */
+template <typename T> T sync_wait(task<T> t) {
+    std::promise<T> promise;
+    std::future<T> future = promise.get_future();
+    detail::fulfil(std::move(t), promise);
+    return future.get();
+}
+
+/**
+ * awaitable that runs func on loop's thread. the awaiting coroutine is resumed on the loop it was running on, or on
+ * loop's thread when it was not running on an event loop. both hops are reported from site by the slow-task watchdog.
+ */
+template <typename Func>
+auto async_on(EventLoop &loop, Func &&func, EventLoop::CallSite site = EventLoop::CallSite::current()) {
+    using func_type = std::decay_t<Func>;
+    using result_type = std::invoke_result_t<func_type &>;
+
+    struct Awaiter {
+        EventLoop &loop;
+        func_type func;
+        EventLoop::CallSite site;
+        std::conditional_t<std::is_void_v<result_type>, bool, std::optional<result_type>> result{};
+        std::exception_ptr exception;
+
+        bool await_ready() const noexcept { return false; }
+        void await_suspend(std::coroutine_handle<> handle) {
+            EventLoop *back = EventLoop::current();
+            auto run = [this, handle, back] {
+                try {
+                    if constexpr (std::is_void_v<result_type>) {
+                        func();
+                    } else {
+                        result.emplace(func());
+                    }
+                } catch (...) {
+                    exception = std::current_exception();
+                }
+                if (back != nullptr && back != &loop) {
+                    back->enqueue([handle] { handle.resume(); }, EventLoop::Priority::Normal, site);
+                } else {
+                    handle.resume();
+                }
+            };
+            loop.enqueue(std::move(run), EventLoop::Priority::Normal, site);
+        }
+        result_type await_resume() {
+            if (exception) {
+                std::rethrow_exception(exception);
+            }
+            if constexpr (!std::is_void_v<result_type>) {
+                return std::move(*result);
+            }
+        }
+    };
+    return Awaiter{loop, std::forward<Func>(func), site, {}, nullptr};
+}
+
+} // namespace handycpp
+
+#ifdef HANDYCPP_TEST
+#include <atomic>
+#include "doctest/doctest.h"
+
+namespace {
+handycpp::task<int> coro_lookup(EventLoop &db, int key) {
+    int doubled = co_await handycpp::async_on(db, [key] { return key * 2; });
+    co_return doubled + 1;
+}
+
+handycpp::task<> coro_session(EventLoop &io, EventLoop &db, std::atomic<int> &sum, std::atomic<int> &wrongThread) {
+    co_await io.schedule();
+    int v = co_await coro_lookup(db, 20);
+    if (EventLoop::current() != &io) {
+        wrongThread++;
+    }
+    co_await db.schedule();
+    if (EventLoop::current() != &db) {
+        wrongThread++;
+    }
+    sum += v;
+}
+} // namespace
+
+TEST_CASE("handycpp::coroutine") {
+    auto io = std::make_unique<EventLoop>();
+    auto db = std::make_unique<EventLoop>();
+
+    CHECK_EQ(handycpp::sync_wait(coro_lookup(*db, 1)), 3);
+
+    std::atomic<int> sum{0};
+    std::atomic<int> wrongThread{0};
+    constexpr int flows = 2000;
+    for (int i = 0; i < flows; i++) {
+        handycpp::spawn(*io, coro_session(*io, *db, sum, wrongThread));
+    }
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (sum.load() < flows * 41 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_EQ(sum.load(), flows * 41);
+    CHECK_EQ(wrongThread.load(), 0);
+    io = nullptr; // io posts into db, so it goes first
+
+    auto failing = [](EventLoop &loop) -> handycpp::task<int> {
+        co_return co_await handycpp::async_on(loop, []() -> int { throw std::runtime_error("boom"); });
+    };
+    CHECK_THROWS_AS(handycpp::sync_wait(failing(*db)), std::runtime_error);
+    db = nullptr;
+}
+#endif
+
+#endif // HANDYCPP_HAS_COROUTINES
+
+#endif // HANDYCPP_COROUTINE_H
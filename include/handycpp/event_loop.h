@@ -4,247 +4,3003 @@
 
 #ifndef HANDYCPP_EVENT_LOOP_H
 #define HANDYCPP_EVENT_LOOP_H
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
 #include <functional>
 #include <future>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <string>
 #include <thread>
+#include <tuple>
+#include <type_traits>
+#include <typeinfo>
+#include <unordered_map>
+#include <utility>
 #include <vector>
 #include <unistd.h>
 
+#if defined(__cpp_impl_coroutine) && __has_include(<coroutine>)
+#include <coroutine>
+#define HANDYCPP_HAS_COROUTINES 1
+#endif
+
 #if defined(__linux__)
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
 #include <sys/types.h>
+#include <cerrno>
+#include <climits>
+#elif defined(__APPLE__)
+#include <pthread.h>
 #else
 #endif
 
+namespace handycpp {
+
 /**
- * event loop is ran in a thread,
- * thread is created in constructor and stop and waited on destructor
+ * intrusive multi-producer/single-consumer queue (Dmitry Vyukov's algorithm).
  *
- * for late initialization, try using a std::unique_ptr and another class to hold event loop
+ * push() is lock-free and may be called from any thread, pop() and empty() must only be called from the single
+ * consumer thread. A producer that has swapped the head but not yet linked its node makes the queue look non-empty
+ * while pop() still fails; the consumer should retry instead of parking in that window.
  *
- * @example
- * \code{.cpp}
- * class A {
- * public:
- *     void start() {
- *         m_loop = std::make_unique<EventLoop>();
- *     }
- *     void stop() {
- *         m_loop = nullptr;
- *     }
- * private:
- *     std::unique_ptr<EventLoop> m_loop = nullptr;
- * }
- * // and when you want to start the loop
- * loop = std::make_unique<EventLoop>();
- * // when you want to stop loop thread:
- * loop = nullptr;
- * \endcode
+ * nodes come from a pool owned by the queue: pop() hands the consumed node back to a lock-free free list and push()
+ * takes one from there, so once the queue has seen its working size neither side touches the allocator. the pool
+ * grows in chunks of doubling size when it runs dry, under a mutex, and keeps its high-water mark until the queue is
+ * destroyed. the free list top is a node index plus a tag in one 64 bit word, which rules out ABA between producers
+ * without double-width atomics.
  */
-class EventLoop {
+template <typename T> class MpscQueue {
 public:
-    using callable_t = std::function<void()>;
+    MpscQueue() {
+        Node *dummy = acquire();
+        m_head.store(dummy, std::memory_order_relaxed);
+        m_tail = dummy;
+    }
+    MpscQueue(const MpscQueue &) = delete;
+    MpscQueue &operator=(const MpscQueue &) = delete;
+    ~MpscQueue() {
+        for (Node *node = m_tail->next.load(std::memory_order_relaxed); node != nullptr;
+             node = node->next.load(std::memory_order_relaxed)) {
+            node->value()->~T();
+        }
+        for (auto &chunk : m_chunks) {
+            delete[] chunk.load(std::memory_order_relaxed);
+        }
+    }
 
-    EventLoop() = default;
-    EventLoop(const EventLoop &) = delete;
-    EventLoop(EventLoop &&) noexcept = delete;
-    ~EventLoop() noexcept {
-        enqueue([this] { m_running = false; });
-        m_thread.join();
+    void push(T &&value) {
+        Node *node = acquire();
+        new (node->storage) T(std::move(value));
+        link(node, node);
     }
 
-    EventLoop &operator=(const EventLoop &) = delete;
-    EventLoop &operator=(EventLoop &&) noexcept = delete;
+    /**
+     * pushes make(*it) for every element of [first, last). the nodes are linked privately and published with a single
+     * exchange, so the batch stays contiguous and in order.
+     */
+    template <typename Iterator, typename Make> void pushBulk(Iterator first, Iterator last, Make &&make) {
+        if (first == last) {
+            return;
+        }
+        Node *chainHead = acquire();
+        new (chainHead->storage) T(make(*first));
+        Node *chainTail = chainHead;
+        for (++first; first != last; ++first) {
+            Node *node = acquire();
+            new (node->storage) T(make(*first));
+            chainTail->next.store(node, std::memory_order_relaxed);
+            chainTail = node;
+        }
+        link(chainHead, chainTail);
+    }
 
-    void enqueue(callable_t &&callable) noexcept {
-        {
-            std::lock_guard<std::mutex> guard(m_mutex);
-            m_writeBuffer.emplace_back(std::move(callable));
+    bool pop(T &out) {
+        return popInto([&out](T &&value) { out = std::move(value); });
+    }
+
+    /**
+     * pops one value and hands it to sink as an rvalue, so T need not be default constructible or assignable
+     */
+    template <typename Sink> bool popInto(Sink &&sink) {
+        Node *next = m_tail->next.load(std::memory_order_acquire);
+        if (next == nullptr) {
+            return false;
         }
-        m_condVar.notify_one();
+        sink(std::move(*next->value()));
+        next->value()->~T();
+        // the producer that linked next was the last one to touch m_tail
+        recycle(m_tail, m_tail);
+        m_tail = next;
+        return true;
     }
 
+    bool empty() const { return m_head.load(std::memory_order_acquire) == m_tail; }
+
     /**
-     * enqueueSync
-     *  pass by reference supported
-     * @tparam Func
-     * @tparam Args
-     * @param callable
-     * @param args
-     * @return
-     * @example
-     * \code{.cpp}
-     * std::cout << eventLoop.enqueueSync([](const int& x, int&& y, int z)
-     * {
-     *     return x + y + z;
-     * }, 1, 2, 3);
-     * \endcode
+     * grows the pool to at least count nodes. the new chunks are allocated and first touched by the calling thread,
+     * so with a NUMA memory policy they come from its node. the first chunk is always the constructing thread's.
      */
-    template <typename Ret, typename... Args>
-    auto enqueueSync(std::function<Ret(Args...)> &&callable, Args &&...args) {
-        if (std::this_thread::get_id() == m_thread.get_id()) {
-            return std::invoke(std::forward<std::function<Ret(Args...)>>(callable), std::forward<Args>(args)...);
+    void reserve(size_t count) {
+        std::lock_guard<std::mutex> guard(m_growMutex);
+        while (m_chunkCount < kChunks && uint64_t(kFirstChunk) * ((uint64_t(1) << m_chunkCount) - 1) < count) {
+            auto [nodes, size] = grow();
+            recycle(&nodes[0], &nodes[size - 1]);
         }
+    }
 
-        using return_type = std::invoke_result_t<std::function<Ret(Args...)>, Args...>;
-        using packaged_task_type = std::packaged_task<return_type(Args && ...)>;
+private:
+    static constexpr uint32_t kFirstChunk = 64;
+    static constexpr size_t kChunks = 26; // kFirstChunk << 26 nodes in total, every index + 1 fits in 32 bits
 
-        packaged_task_type task(std::forward<std::function<Ret(Args...)>>(callable));
+    struct Node {
+        T *value() { return std::launder(reinterpret_cast<T *>(storage)); }
 
-        enqueue([&] { task(std::forward<Args>(args)...); });
+        std::atomic<Node *> next{nullptr};
+        std::atomic<uint32_t> freeNext{0}; // index + 1 of the next free node, 0 for none
+        uint32_t index = 0;
+        alignas(T) unsigned char storage[sizeof(T)]; // holds a value from push() to pop()
+    };
 
-        return task.get_future().get();
+    void link(Node *first, Node *last) {
+        last->next.store(nullptr, std::memory_order_relaxed);
+        Node *prev = m_head.exchange(last, std::memory_order_acq_rel);
+        prev->next.store(first, std::memory_order_release);
     }
 
-    /**
-     * pass by reference not supported
-     * @tparam Func
-     * @tparam Args
-     * @param callable
-     * @param args
-     * @return
-     */
-    template<typename Func, typename... Args>
-    auto enqueueSync(Func&& callable, Args&& ...args)
-    {
-        if (std::this_thread::get_id() == m_thread.get_id())
-        {
-            return std::invoke(
-                std::forward<Func>(callable),
-                std::forward<Args>(args)...);
+    // chunk k holds kFirstChunk << k nodes and starts at index kFirstChunk * (2^k - 1)
+    Node *nodeAt(uint32_t index) const {
+        uint64_t scaled = uint64_t(index) / kFirstChunk + 1;
+        unsigned chunk = 63 - __builtin_clzll(scaled);
+        uint64_t first = uint64_t(kFirstChunk) * ((uint64_t(1) << chunk) - 1);
+        return m_chunks[chunk].load(std::memory_order_acquire) + (index - first);
+    }
+
+    Node *tryAcquire() {
+        uint64_t top = m_free.load(std::memory_order_acquire);
+        while (static_cast<uint32_t>(top) != 0) {
+            Node *node = nodeAt(static_cast<uint32_t>(top) - 1);
+            // stale if another producer took the node meanwhile, the tag then fails the exchange
+            uint64_t next = (((top >> 32) + 1) << 32) | node->freeNext.load(std::memory_order_relaxed);
+            if (m_free.compare_exchange_weak(top, next, std::memory_order_acquire, std::memory_order_acquire)) {
+                return node;
+            }
+        }
+        return nullptr;
+    }
+
+    Node *acquire() {
+        if (Node *node = tryAcquire()) {
+            return node;
+        }
+        std::lock_guard<std::mutex> guard(m_growMutex);
+        if (Node *node = tryAcquire()) {
+            return node; // somebody else grew the pool while we waited
+        }
+        if (m_chunkCount == kChunks) {
+            throw std::bad_alloc();
+        }
+        auto [nodes, size] = grow();
+        if (size > 1) {
+            recycle(&nodes[1], &nodes[size - 1]);
+        }
+        return &nodes[0];
+    }
+
+    // adds the next chunk with its nodes chained through freeNext, not yet on the free list. needs m_growMutex
+    std::pair<Node *, size_t> grow() {
+        size_t chunk = m_chunkCount;
+        size_t size = size_t(kFirstChunk) << chunk;
+        uint32_t first = uint32_t(uint64_t(kFirstChunk) * ((uint64_t(1) << chunk) - 1));
+        Node *nodes = new Node[size];
+        for (size_t i = 0; i < size; i++) {
+            nodes[i].index = first + uint32_t(i);
+            nodes[i].freeNext.store(first + uint32_t(i) + 2, std::memory_order_relaxed);
         }
+        m_chunks[chunk].store(nodes, std::memory_order_release);
+        m_chunkCount++;
+        return {nodes, size};
+    }
+
+    // puts the free chain first..last, linked through freeNext, back on the free list
+    void recycle(Node *first, Node *last) {
+        uint64_t top = m_free.load(std::memory_order_relaxed);
+        uint64_t next;
+        do {
+            last->freeNext.store(static_cast<uint32_t>(top), std::memory_order_relaxed);
+            next = (((top >> 32) + 1) << 32) | (uint64_t(first->index) + 1);
+        } while (!m_free.compare_exchange_weak(top, next, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    std::atomic<Node *> m_head{nullptr};
+    Node *m_tail = nullptr; // only touched by the consumer, always points to the already consumed dummy node
+    std::atomic<uint64_t> m_free{0}; // tag << 32 | (index + 1) of the first free node
+    std::atomic<Node *> m_chunks[kChunks] = {};
+    size_t m_chunkCount = 0; // guarded by m_growMutex
+    std::mutex m_growMutex;
+};
+
+template <typename Signature> class MoveOnlyFunction;
+
+/**
+ * a move-only replacement for std::function.
+ *
+ * callables up to inline_size bytes that are nothrow movable are stored inside the object, bigger ones fall back to
+ * the heap. move-only captures such as std::promise or std::unique_ptr are accepted.
+ *
+ * @example
+ * \code{.cpp}
+ * std::promise<int> promise;
+ * MoveOnlyFunction<void()> f = [p = std::move(promise)]() mutable { p.set_value(1); };
+ * f();
+ * \endcode
+ */
+template <typename R, typename... Args> class MoveOnlyFunction<R(Args...)> {
+public:
+    static constexpr size_t inline_size = 6 * sizeof(void *);
 
-        using return_type = std::invoke_result_t<Func, Args...>;
-        using packaged_task_type =
-            std::packaged_task<return_type(Args&&...)>;
+    template <typename T>
+    static constexpr bool fits_inline = sizeof(T) <= inline_size && alignof(T) <= alignof(std::max_align_t) &&
+                                        std::is_nothrow_move_constructible_v<T>;
 
-        packaged_task_type task(std::forward<Func>(callable));
+    MoveOnlyFunction() noexcept = default;
+    MoveOnlyFunction(std::nullptr_t) noexcept {}
 
-        enqueue([&]
-                {
-                    task(std::forward<Args>(args)...);
-                });
+    template <
+        typename F,
+        typename T = std::decay_t<F>,
+        typename = std::enable_if_t<!std::is_same_v<T, MoveOnlyFunction> && std::is_invocable_r_v<R, T &, Args...>>>
+    MoveOnlyFunction(F &&f) {
+        if constexpr (std::is_pointer_v<T> || std::is_member_pointer_v<T>) {
+            if (f == nullptr) {
+                return;
+            }
+        }
+        if constexpr (fits_inline<T>) {
+            ::new (static_cast<void *>(m_storage)) T(std::forward<F>(f));
+        } else {
+            *reinterpret_cast<T **>(m_storage) = new T(std::forward<F>(f));
+        }
+        m_ops = &ops<T>;
+    }
 
-        return task.get_future().get();
+    MoveOnlyFunction(MoveOnlyFunction &&other) noexcept : m_ops(other.m_ops) {
+        if (m_ops != nullptr) {
+            m_ops->move(m_storage, other.m_storage);
+            other.m_ops = nullptr;
+        }
     }
+    MoveOnlyFunction(const MoveOnlyFunction &) = delete;
 
-    template <class T> std::reference_wrapper<T> maybe_wrap(T& val) { return std::ref(val); }
-    template <class T> T&& maybe_wrap(T&& val) { return std::forward<T>(val); }
+    ~MoveOnlyFunction() { reset(); }
 
-    /**
-     * enqueueAsync
-     * @tparam Func
-     * @tparam Args
-     * @param callable
-     * @param args
-     * @return std::future
-     * @example
-     * \code{.cpp}
-     * std::future<int> result = eventLoop.enqueueAsync([](int x, int y)
-     * {
-     *    return x + y;
-     * }, 1, 2);
-     * //
-     * //do some heavy work here
-     * //
-     * std::cout << result.get();
-     * \endcode
-     */
-    template<typename Func, typename... Args>
-    [[nodiscard]] auto enqueueAsync(Func&& callable, Args&& ...args)
-    {
-        using return_type = std::invoke_result_t<Func, Args...>;
-        using packaged_task_type = std::packaged_task<return_type()>;
+    MoveOnlyFunction &operator=(MoveOnlyFunction &&other) noexcept {
+        if (this != &other) {
+            reset();
+            if (other.m_ops != nullptr) {
+                other.m_ops->move(m_storage, other.m_storage);
+                m_ops = other.m_ops;
+                other.m_ops = nullptr;
+            }
+        }
+        return *this;
+    }
+    MoveOnlyFunction &operator=(const MoveOnlyFunction &) = delete;
+    MoveOnlyFunction &operator=(std::nullptr_t) noexcept {
+        reset();
+        return *this;
+    }
 
-        auto taskPtr = std::make_shared<packaged_task_type>(std::bind(
-            std::forward<Func>(callable), maybe_wrap(std::forward<Args>(args))...));
+    explicit operator bool() const noexcept { return m_ops != nullptr; }
 
-        enqueue(std::bind(&packaged_task_type::operator(), taskPtr));
+    R operator()(Args... args) { return m_ops->invoke(m_storage, std::forward<Args>(args)...); }
 
-        return taskPtr->get_future();
+private:
+    struct Ops {
+        R (*invoke)(void *storage, Args &&...args);
+        void (*move)(void *dst, void *src) noexcept; // move constructs into dst and destroys src
+        void (*destroy)(void *storage) noexcept;
+    };
+
+    template <typename T> static T *target(void *storage) noexcept {
+        if constexpr (fits_inline<T>) {
+            return std::launder(reinterpret_cast<T *>(storage));
+        } else {
+            return *reinterpret_cast<T **>(storage);
+        }
     }
 
-    template<typename Ret, typename... Args>
-    [[nodiscard]] auto enqueueAsync(std::function<Ret(Args...)>& callable, Args&& ...args)
-    {
-        using return_type = std::invoke_result_t<std::function<Ret(Args...)>, Args...>;
-        using packaged_task_type = std::packaged_task<return_type()>;
+    template <typename T>
+    static constexpr Ops ops{
+        [](void *storage, Args &&...args) -> R {
+            return std::invoke(*target<T>(storage), std::forward<Args>(args)...);
+        },
+        [](void *dst, void *src) noexcept {
+            if constexpr (fits_inline<T>) {
+                ::new (dst) T(std::move(*target<T>(src)));
+                target<T>(src)->~T();
+            } else {
+                *reinterpret_cast<T **>(dst) = target<T>(src);
+            }
+        },
+        [](void *storage) noexcept {
+            if constexpr (fits_inline<T>) {
+                target<T>(storage)->~T();
+            } else {
+                delete target<T>(storage);
+            }
+        }};
+
+    void reset() noexcept {
+        if (m_ops != nullptr) {
+            m_ops->destroy(m_storage);
+            m_ops = nullptr;
+        }
+    }
 
-        auto taskPtr = std::make_shared<packaged_task_type>(std::bind(
-            std::forward<std::function<Ret(Args...)>>(callable), maybe_wrap(std::forward<Args>(args))...));
+    const Ops *m_ops = nullptr;
+    alignas(std::max_align_t) unsigned char m_storage[inline_size];
+};
+
+// lvalue arguments are bound by reference, the same rule EventLoop has always used. rvalues are moved into the task
+// and moved out again when it runs, a task only ever runs once.
+template <typename Arg>
+using bound_arg_t = std::conditional_t<
+    std::is_lvalue_reference_v<Arg>,
+    std::reference_wrapper<std::remove_reference_t<Arg>>,
+    std::decay_t<Arg>>;
 
-        enqueue(std::bind(&packaged_task_type::operator(), taskPtr));
+template <typename T> T &unwrap_bound_arg(std::reference_wrapper<T> arg) { return arg.get(); }
+template <typename T> T &&unwrap_bound_arg(T &arg) { return std::move(arg); }
 
-        return taskPtr->get_future();
+// runs func with the bound arguments and hands the outcome to promise
+template <typename Return, typename Func, typename Bound>
+void fulfil(std::promise<Return> &promise, Func &func, Bound &bound) noexcept {
+    try {
+        if constexpr (std::is_void_v<Return>) {
+            std::apply([&](auto &...a) { std::invoke(func, unwrap_bound_arg(a)...); }, bound);
+            promise.set_value();
+        } else {
+            promise.set_value(std::apply([&](auto &...a) { return std::invoke(func, unwrap_bound_arg(a)...); }, bound));
+        }
+    } catch (...) {
+        promise.set_exception(std::current_exception());
     }
+}
 
+/**
+ * packs callable and args into a single move-only task that fulfils the returned future when run.
+ * the std::promise lives inside the task, so the future's shared state is the only allocation.
+ */
+template <typename Func, typename... Args> auto makeAsyncTask(Func &&callable, Args &&...args) {
+    using return_type = std::invoke_result_t<Func, Args...>;
 
-    int gettid() {
-       return tid;
+    std::promise<return_type> promise;
+    std::future<return_type> future = promise.get_future();
+    MoveOnlyFunction<void()> task(
+        [promise = std::move(promise),
+         func = std::decay_t<Func>(std::forward<Func>(callable)),
+         bound = std::tuple<bound_arg_t<Args>...>(std::forward<Args>(args)...)]() mutable {
+            fulfil(promise, func, bound);
+        });
+    return std::make_pair(std::move(task), std::move(future));
+}
+
+/**
+ * the error a future gets when its task was skipped because its CancellationToken was cancelled or expired
+ */
+class TaskCancelled : public std::runtime_error {
+public:
+    TaskCancelled() : std::runtime_error("task cancelled") {}
+};
+
+/**
+ * tells queued tasks that their result is no longer wanted. copies share one state, so the token can go with every
+ * task of a request and be cancelled from wherever the request is abandoned. a token may also carry a deadline,
+ * after which it counts as cancelled by itself.
+ *
+ * EventLoop checks the token when it takes the task off the queue and skips the task if it is cancelled, a task
+ * that is already running can poll cancelled() itself.
+ *
+ * @example
+ * \code{.cpp}
+ * auto token = handycpp::CancellationToken::withTimeout(std::chrono::milliseconds(50));
+ * auto reply = loop.enqueueAsync(token, [=] { return lookup(key); });
+ * ...
+ * token.cancel(); // client went away
+ * \endcode
+ */
+class CancellationToken {
+public:
+    using clock = std::chrono::steady_clock;
+
+    CancellationToken() : m_state(std::make_shared<State>()) {}
+
+    static CancellationToken withDeadline(clock::time_point deadline) {
+        CancellationToken token;
+        token.m_state->deadline = deadline;
+        return token;
     }
-    int getpid() {
-        return pid;
+    static CancellationToken withTimeout(std::chrono::nanoseconds timeout) {
+        return withDeadline(clock::now() + timeout);
+    }
+
+    // the state is shared, cancelling through any copy, const or not, cancels them all
+    void cancel() const noexcept { m_state->cancelled.store(true, std::memory_order_release); }
+
+    bool cancelled() const noexcept {
+        if (m_state->cancelled.load(std::memory_order_acquire)) {
+            return true;
+        }
+        if (m_state->deadline != clock::time_point::max() && clock::now() >= m_state->deadline) {
+            cancel(); // later checks skip the clock read
+            return true;
+        }
+        return false;
     }
 
+    clock::time_point deadline() const noexcept { return m_state->deadline; }
+
 private:
-    std::vector<callable_t> m_writeBuffer;
-    std::mutex m_mutex{};
-    std::condition_variable m_condVar{};
+    struct State {
+        std::atomic<bool> cancelled{false};
+        clock::time_point deadline = clock::time_point::max(); // fixed at construction
+    };
 
-    bool m_running{true};
-    std::thread m_thread{&EventLoop::threadFunc, this};
+    std::shared_ptr<State> m_state;
+};
 
-    int tid;
-    int pid;
+/**
+ * makeAsyncTask for a task that may be skipped: if it is destroyed unrun while token is cancelled, the future gets
+ * TaskCancelled instead of a broken promise.
+ */
+template <typename Func, typename... Args>
+auto makeCancellableTask(CancellationToken token, Func &&callable, Args &&...args) {
+    using return_type = std::invoke_result_t<Func, Args...>;
+    using func_type = std::decay_t<Func>;
+    using bound_type = std::tuple<bound_arg_t<Args>...>;
 
-    void threadFunc() noexcept {
-        std::vector<callable_t> readBuffer;
+    struct Task {
+        std::promise<return_type> promise;
+        CancellationToken token;
+        func_type func;
+        bound_type bound;
+        bool pending = true;
+
+        Task(std::promise<return_type> &&promise, CancellationToken &&token, func_type &&func, bound_type &&bound)
+            : promise(std::move(promise)), token(std::move(token)), func(std::move(func)), bound(std::move(bound)) {}
+        Task(Task &&other) noexcept
+            : promise(std::move(other.promise)),
+              token(other.token),
+              func(std::move(other.func)),
+              bound(std::move(other.bound)),
+              pending(std::exchange(other.pending, false)) {}
+        ~Task() {
+            if (pending && token.cancelled()) {
+                promise.set_exception(std::make_exception_ptr(TaskCancelled()));
+            }
+        }
+        void operator()() {
+            pending = false;
+            fulfil(promise, func, bound);
+        }
+    };
+
+    std::promise<return_type> promise;
+    std::future<return_type> future = promise.get_future();
+    MoveOnlyFunction<void()> task(Task(
+        std::move(promise),
+        std::move(token),
+        func_type(std::forward<Func>(callable)),
+        bound_type(std::forward<Args>(args)...)));
+    return std::make_pair(std::move(task), std::move(future));
+}
+
+/**
+ * single-use latch meant to live on the waiting thread's stack. on linux it is one futex word, elsewhere a mutex and a
+ * condition variable, neither allocates.
+ */
+class OneShotLatch {
+public:
+    void countDown() noexcept {
 #if defined(__linux__)
-        tid = (int)::gettid();
-        pid = (int)::getpid();
-        printf("--%d\n", tid);
-#elif defined(_WIN32)
-        tid = (int)GetCurrentThreadId();
-        pid = (int)GetCurrentProcessId();
+        if (m_state.exchange(kDone, std::memory_order_release) == kSleeping) {
+            ::syscall(SYS_futex, reinterpret_cast<int *>(&m_state), FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+        }
 #else
+        // notify under the lock, the waiter may destroy the latch as soon as it can see kDone
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_state.store(kDone, std::memory_order_release);
+        m_condVar.notify_all();
 #endif
+    }
 
-        while (m_running) {
-            {
-                std::unique_lock<std::mutex> lock(m_mutex);
-                m_condVar.wait(lock, [this] { return !m_writeBuffer.empty(); });
-                std::swap(readBuffer, m_writeBuffer);
+    void wait() noexcept {
+#if defined(__linux__)
+        int state = kIdle;
+        if (m_state.compare_exchange_strong(state, kSleeping, std::memory_order_acquire) || state == kSleeping) {
+            while (m_state.load(std::memory_order_acquire) != kDone) {
+                ::syscall(SYS_futex, reinterpret_cast<int *>(&m_state), FUTEX_WAIT_PRIVATE, kSleeping, nullptr, nullptr, 0);
             }
+        }
+#else
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_condVar.wait(lock, [this] { return m_state.load(std::memory_order_acquire) == kDone; });
+#endif
+    }
 
-            for (callable_t &func : readBuffer) {
-                func();
+private:
+    static constexpr int kIdle = 0;
+    static constexpr int kSleeping = 1;
+    static constexpr int kDone = 2;
+    std::atomic<int> m_state{kIdle};
+    static_assert(sizeof(std::atomic<int>) == sizeof(int), "the futex word must be a plain int");
+#if !defined(__linux__)
+    std::mutex m_mutex;
+    std::condition_variable m_condVar;
+#endif
+};
+
+/**
+ * calls post with a task that runs callable(args...) and blocks until that task has run, then returns its result or
+ * rethrows its exception. result, exception and latch all live in this stack frame and the posted task only holds
+ * pointers to it, so it always fits a MoveOnlyFunction's inline storage and nothing is allocated.
+ * a task that is destroyed without running, e.g. dropped by a full bounded loop, throws std::future_error with
+ * broken_promise, the same as a dropped enqueueAsync task.
+ */
+template <typename Post, typename Func, typename... Args> auto runSync(Post &&post, Func &&callable, Args &&...args) {
+    using return_type = std::invoke_result_t<Func, Args...>;
+    using value_type = std::conditional_t<std::is_void_v<return_type>, bool, std::decay_t<return_type>>;
+
+    std::optional<value_type> result;
+    std::exception_ptr exception;
+    OneShotLatch done;
+    auto work = [&] {
+        try {
+            if constexpr (std::is_void_v<return_type>) {
+                std::invoke(std::forward<Func>(callable), std::forward<Args>(args)...);
+            } else {
+                result.emplace(std::invoke(std::forward<Func>(callable), std::forward<Args>(args)...));
             }
+        } catch (...) {
+            exception = std::current_exception();
+        }
+        done.countDown();
+    };
+    auto abandon = [&] {
+        exception = std::make_exception_ptr(std::future_error(std::future_errc::broken_promise));
+        done.countDown();
+    };
 
-            readBuffer.clear();
+    struct Task {
+        decltype(work) *run;
+        decltype(abandon) *drop;
+        Task(decltype(work) *run, decltype(abandon) *drop) noexcept : run(run), drop(drop) {}
+        Task(Task &&other) noexcept : run(std::exchange(other.run, nullptr)), drop(other.drop) {}
+        ~Task() {
+            if (run != nullptr) {
+                (*drop)();
+            }
         }
+        void operator()() { (*std::exchange(run, nullptr))(); }
+    };
+    post(MoveOnlyFunction<void()>(Task(&work, &abandon)));
+    done.wait();
+
+    if (exception) {
+        std::rethrow_exception(exception);
     }
-};
+    if constexpr (!std::is_void_v<return_type>) {
+        return value_type(std::move(*result));
+    }
+}
 
-#ifdef HANDYCPP_TEST
-#include "doctest/doctest.h"
-#endif
+/**
+ * power-of-two latency histogram. bucket 0 counts durations below 1us, bucket i counts [2^(i-1), 2^i) microseconds,
+ * the last bucket also takes everything above.
+ */
+class LatencyHistogram {
+public:
+    static constexpr size_t kBuckets = 32;
 
-#ifdef HANDYCPP_TEST
-TEST_CASE("handycpp::event_loop") {
-    std::unique_ptr<EventLoop> loop = std::make_unique<EventLoop>();
+    static size_t bucketOf(std::chrono::nanoseconds duration) noexcept {
+        auto us = (uint64_t)std::max<int64_t>(0, std::chrono::duration_cast<std::chrono::microseconds>(duration).count());
+        size_t bucket = 0;
+        while (us != 0 && bucket < kBuckets - 1) {
+            us >>= 1;
+            bucket++;
+        }
+        return bucket;
+    }
 
-    std::function<int(int, int)> f = [](int x, int y) -> int {
-        return x+ y;
-    };
-    std::future result = loop->enqueueAsync(f, 1, 2);
-    CHECK((result.get() == 3));
+    void record(std::chrono::nanoseconds duration) noexcept {
+        buckets[bucketOf(duration)]++;
+        count++;
+    }
 
+    /**
+     * upper bound of the bucket holding the p-th percentile, p in [0, 100]
+     */
+    std::chrono::microseconds percentile(double p) const noexcept {
+        if (count == 0) {
+            return std::chrono::microseconds(0);
+        }
+        auto rank = (uint64_t)((double)count * p / 100.0);
+        uint64_t seen = 0;
+        for (size_t i = 0; i < kBuckets; i++) {
+            seen += buckets[i];
+            if (seen > rank || seen == count) {
+                return std::chrono::microseconds(uint64_t(1) << i);
+            }
+        }
+        return std::chrono::microseconds(uint64_t(1) << (kBuckets - 1));
+    }
 
-    int a = 2 , b = 3;
-    std::future result1 = loop->enqueueAsync([&]() { a=b; });
-    result1.wait();
+    std::array<uint64_t, kBuckets> buckets{};
+    uint64_t count = 0;
+};
+
+/**
+ * where a loop or worker thread runs: which cpus, which NUMA node, under which name and scheduling policy. every
+ * field is optional, an empty placement leaves the thread as the system created it.
+ *
+ * the thread applies its placement itself before it runs its first task. a setting that does not take, e.g. a
+ * realtime policy without CAP_SYS_NICE, is reported to onError, or to stderr when that is empty, and the thread
+ * carries on with the rest. linux only, elsewhere only the name is applied where the platform allows it.
+ *
+ * @example
+ * \code{.cpp}
+ * EventLoop::Options options;
+ * options.placement.numaNode = 1;     // runs on the cpus of node 1 and allocates from its memory
+ * options.placement.name = "net-io";
+ * options.placement.policy = SCHED_FIFO;
+ * options.placement.priority = 10;
+ * EventLoop loop(options);
+ * \endcode
+ */
+struct ThreadPlacement {
+    /**
+     * cpus the thread may run on, empty means every cpu, or the cpus of numaNode when that is set
+     */
+    std::vector<int> cpus;
+    /**
+     * for pools: pin worker i to the i-th of those cpus alone instead of letting every worker float over all of them
+     */
+    bool spread = false;
+    /**
+     * prefer memory of this node for everything the thread allocates, -1 for the system default
+     */
+    int numaNode = -1;
+    /**
+     * at most 15 characters show up in top and gdb, pool workers get "-<index>" appended
+     */
+    std::string name;
+    /**
+     * SCHED_OTHER, SCHED_BATCH, SCHED_IDLE, SCHED_FIFO or SCHED_RR, priority is only used by the last two
+     */
+    std::optional<int> policy;
+    int priority = 0;
+    std::function<void(const char *what, int error)> onError;
+
+    bool empty() const noexcept { return cpus.empty() && numaNode < 0 && name.empty() && !policy; }
+
+    /**
+     * the placement of the index-th worker of a pool that was given this one
+     */
+    ThreadPlacement forWorker(size_t index) const {
+        ThreadPlacement worker = *this;
+        if (!name.empty()) {
+            std::string suffix = "-" + std::to_string(index);
+            worker.name = name.substr(0, kMaxName - std::min(kMaxName, suffix.size())) + suffix;
+        }
+        if (spread) {
+            std::vector<int> pool = cpus.empty() && numaNode >= 0 ? cpusOfNode(numaNode) : cpus;
+            if (!pool.empty()) {
+                worker.cpus = {pool[index % pool.size()]};
+            }
+        }
+        return worker;
+    }
+
+    /**
+     * applies the placement to the calling thread, false if any part of it failed
+     */
+    bool apply() const noexcept {
+        bool ok = true;
+#if defined(__linux__)
+        std::vector<int> allowed = cpus.empty() && numaNode >= 0 ? cpusOfNode(numaNode) : cpus;
+        if (!allowed.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            for (int cpu : allowed) {
+                if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                    CPU_SET(cpu, &set);
+                }
+            }
+            ok = check("cpu affinity", pthread_setaffinity_np(pthread_self(), sizeof(set), &set)) && ok;
+        }
+        if (numaNode >= 0) {
+            constexpr size_t bits = sizeof(unsigned long) * CHAR_BIT;
+            std::vector<unsigned long> mask((size_t)numaNode / bits + 1, 0);
+            mask[(size_t)numaNode / bits] = 1UL << ((size_t)numaNode % bits);
+            // the kernel reads maxnode - 1 bits
+            long ret = syscall(SYS_set_mempolicy, MPOL_PREFERRED, mask.data(), mask.size() * bits + 1);
+            ok = check("numa memory policy", ret == 0 ? 0 : errno) && ok;
+        }
+        if (!name.empty()) {
+            ok = check("thread name", pthread_setname_np(pthread_self(), name.substr(0, kMaxName).c_str())) && ok;
+        }
+        if (policy) {
+            sched_param param{};
+            param.sched_priority = *policy == SCHED_FIFO || *policy == SCHED_RR ? priority : 0;
+            ok = check("scheduling policy", pthread_setschedparam(pthread_self(), *policy, &param)) && ok;
+        }
+#elif defined(__APPLE__)
+        if (!name.empty()) {
+            ok = check("thread name", pthread_setname_np(name.c_str()));
+        }
+        ok = ok && cpus.empty() && numaNode < 0 && !policy;
+#else
+        ok = empty();
+#endif
+        return ok;
+    }
+
+    /**
+     * the cpus of a NUMA node as listed by sysfs, empty if the node does not exist
+     */
+    static std::vector<int> cpusOfNode(int node) {
+        std::vector<int> result;
+#if defined(__linux__)
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+        FILE *file = fopen(path, "r");
+        if (file == nullptr) {
+            return result;
+        }
+        // "0-7,16-23"
+        int first;
+        while (fscanf(file, "%d", &first) == 1) {
+            int last = first;
+            int separator = fgetc(file);
+            if (separator == '-') {
+                if (fscanf(file, "%d", &last) != 1) {
+                    break;
+                }
+                separator = fgetc(file);
+            }
+            for (int cpu = first; cpu <= last; cpu++) {
+                result.push_back(cpu);
+            }
+            if (separator != ',') {
+                break;
+            }
+        }
+        fclose(file);
+#else
+        (void)node;
+#endif
+        return result;
+    }
+
+private:
+    static constexpr size_t kMaxName = 15; // linux keeps 16 bytes including the terminator
+
+    bool check(const char *what, int error) const noexcept {
+        if (error == 0) {
+            return true;
+        }
+        if (onError) {
+            onError(what, error);
+        } else {
+            fprintf(stderr, "handycpp: could not set %s of thread %s: %s\n", what, name.c_str(), strerror(error));
+        }
+        return false;
+    }
+};
+
+} // namespace handycpp
+
+/**
+ * event loop is ran in a thread,
+ * thread is created in constructor and stop and waited on destructor
+ *
+ * for late initialization, try using a std::unique_ptr and another class to hold event loop
+ *
+ * the loop must outlive every thread that may still be inside one of its enqueue calls, when loops post into each
+ * other destroy the producers first.
+ *
+ * @example
+ * \code{.cpp}
+ * class A {
+ * public:
+ *     void start() {
+ *         m_loop = std::make_unique<EventLoop>();
+ *     }
+ *     void stop() {
+ *         m_loop = nullptr;
+ *     }
+ * private:
+ *     std::unique_ptr<EventLoop> m_loop = nullptr;
+ * }
+ * // and when you want to start the loop
+ * loop = std::make_unique<EventLoop>();
+ * // when you want to stop loop thread:
+ * loop = nullptr;
+ * \endcode
+ */
+class EventLoop {
+public:
+    using callable_t = handycpp::MoveOnlyFunction<void()>;
+    // receives the ready events, e.g. EPOLLIN | EPOLLHUP
+    using fd_callback_t = handycpp::MoveOnlyFunction<void(uint32_t)>;
+
+    /**
+     * every priority has its own queue. before each task the loop looks at the higher lanes first, so a High task
+     * waits for at most the task that is currently running. see Options::starvationLimit for the lower lanes.
+     */
+    enum class Priority : uint8_t { High = 0, Normal = 1, Background = 2 };
+
+    /**
+     * where a task was posted from, filled in by enqueue() and enqueueBulk() through a default argument
+     */
+    struct CallSite {
+        const char *file = nullptr;
+        int line = 0;
+#if defined(__GNUC__) || defined(__clang__)
+        static constexpr CallSite current(const char *file = __builtin_FILE(), int line = __builtin_LINE()) noexcept {
+            return {file, line};
+        }
+#else
+        static constexpr CallSite current() noexcept { return {}; }
+#endif
+    };
+
+    /**
+     * handed to Options::onSlowTask while the offending task is still running
+     */
+    struct SlowTask {
+        CallSite site;
+        std::chrono::nanoseconds running; // how long it had been running when the watchdog noticed
+    };
+
+    /**
+     * what a bounded loop does with a task that arrives while it is full
+     */
+    enum class Overflow : uint8_t {
+        Block,      // enqueue waits for room, tryEnqueue returns false
+        Fail,       // the task is refused, tryEnqueue returns false
+        DropOldest, // the oldest task still queued in the same lane is destroyed unrun to make room
+        DropNewest, // the new task is destroyed unrun, tryEnqueue returns false
+    };
+
+    struct Stats {
+        size_t queueDepth = 0;     // queued but not yet started, always available
+        size_t peakQueueDepth = 0; // the rest needs Options::instrument
+        uint64_t tasksRun = 0;
+        uint64_t wakeups = 0;        // times the loop thread came back from parking
+        double wakeupsPerSecond = 0; // since the previous stats() call
+        uint64_t spinHits = 0;       // times work showed up while spinning or yielding, so no park was needed
+        uint64_t slowTasks = 0;
+        // bounded loops only, see Options::capacity. these are counted whether or not the loop is instrumented
+        uint64_t blocked = 0;       // producers that had to wait for room
+        uint64_t rejected = 0;      // tasks refused by tryEnqueue, or by enqueue under Overflow::Fail
+        uint64_t droppedOldest = 0; // queued tasks evicted to make room under Overflow::DropOldest
+        uint64_t droppedNewest = 0; // new tasks thrown away under Overflow::DropNewest
+        uint64_t coalesced = 0;     // enqueueUnique/enqueueReplace posts absorbed by a pending task of the same key
+        uint64_t cancelled = 0;     // tasks skipped because their CancellationToken was cancelled or expired
+        handycpp::LatencyHistogram waitTime; // enqueue to start
+        handycpp::LatencyHistogram runTime;
+    };
+
+    struct Options {
+        /**
+         * post tasks through a lock-free MPSC queue instead of the mutex protected vector.
+         * producers never block each other and only touch the mutex when the loop thread is parked.
+         */
+        bool lockFree = false;
+        /**
+         * park the loop in epoll_wait instead of on a condition variable, so file descriptors registered with addFd()
+         * are served on the loop thread. cross-thread enqueues wake the loop through an eventfd. linux only.
+         */
+        bool io = false;
+        /**
+         * a lane that has work but was passed over this many times in a row in favour of higher lanes gets to run one
+         * task, so a flood of High tasks can not starve Normal and Background forever.
+         */
+        unsigned int starvationLimit = 32;
+        /**
+         * collect the numbers returned by stats(): peak queue depth, wait and run time histograms, wakeups.
+         * costs two clock reads per task.
+         */
+        bool instrument = false;
+        /**
+         * when non-zero a watchdog thread reports every task that has been running for longer than this, together
+         * with the place it was enqueued from. the report goes to onSlowTask, or to stderr when that is empty.
+         */
+        std::chrono::nanoseconds slowTaskThreshold{0};
+        std::function<void(const SlowTask &)> onSlowTask;
+        /**
+         * how the loop waits when it runs out of work: busy-poll the queues for up to spinFor, then keep polling but
+         * yield the cpu in between for up to yieldFor, then park. producers skip the futex/eventfd wake while the
+         * loop is still spinning or yielding, which takes tens of microseconds off every hop into an idle loop.
+         *
+         * the spin window adapts: it is halved (down to spinFor / 16) every time it runs out and the loop parks,
+         * and doubled back up to spinFor every time work arrives in time, so a loop that goes quiet stops burning
+         * its core. both zero, the default, parks right away.
+         */
+        std::chrono::nanoseconds spinFor{0};
+        std::chrono::nanoseconds yieldFor{0};
+        /**
+         * when non-zero at most this many tasks, summed over all lanes, are queued at a time and overflow decides
+         * what happens to the rest. a bounded loop always uses the mutex queue, lockFree is ignored.
+         *
+         * the loop thread posting to itself is never blocked, it would wait for itself forever. a task that is
+         * dropped is destroyed without running: enqueueAsync futures and enqueueSync callers get a broken_promise
+         * std::future_error. do not combine the drop policies with coroutines, a dropped resumption leaks its frame.
+         */
+        size_t capacity = 0;
+        Overflow overflow = Overflow::Block;
+        /**
+         * do not start a thread. the loop runs inside runOnce() and poll(), called from whatever thread drives it,
+         * e.g. an existing reactor or a benchmark. enqueueSync from the driving thread runs inline, just like from
+         * the loop thread of a threaded loop. tasks still queued when the loop is destroyed are destroyed unrun.
+         */
+        bool threadless = false;
+        /**
+         * cpus, NUMA node, name and scheduling policy of the loop thread. with a NUMA node the task buffers are
+         * allocated from the loop thread, so they come from that node's memory. with lockFree that holds for all but
+         * the first 64 queue nodes of each lane, which the constructor allocates. ignored by a threadless loop, its
+         * driving thread belongs to the caller.
+         */
+        handycpp::ThreadPlacement placement;
+    };
+
+    EventLoop() = default;
+    explicit EventLoop(const Options &options) : m_options(sanitize(options)) {
+        if (m_options.threadless) {
+            recordThreadIds();
+        }
+        if (m_options.slowTaskThreshold.count() > 0) {
+            m_watchdog = std::thread(&EventLoop::watchdogFunc, this);
+        }
+    }
+    EventLoop(const EventLoop &) = delete;
+    EventLoop(EventLoop &&) noexcept = delete;
+    /**
+     * runs every task that is already queued, in all lanes, then stops and joins the loop thread
+     */
+    ~EventLoop() noexcept {
+        if (m_watchdog.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(m_watchdogMutex);
+                m_watchdogStop = true;
+            }
+            m_watchdogCond.notify_one();
+            m_watchdog.join();
+        }
+        if (m_thread.joinable()) {
+            post(Priority::Background, Entry{[this] { stopWhenDrained(); }, 0, {}}, Admission::Force);
+            m_thread.join();
+        }
+#if defined(__linux__)
+        if (m_epollFd >= 0) {
+            ::close(m_epollFd);
+        }
+        if (m_eventFd >= 0) {
+            ::close(m_eventFd);
+        }
+#endif
+    }
+
+    EventLoop &operator=(const EventLoop &) = delete;
+    EventLoop &operator=(EventLoop &&) noexcept = delete;
+
+    void enqueue(
+        callable_t &&callable,
+        Priority priority = Priority::Normal,
+        CallSite site = CallSite::current()) noexcept {
+        post(priority, Entry{std::move(callable), stamp(), site}, Admission::Wait);
+    }
+
+    /**
+     * enqueue, but the task is skipped without running if token is cancelled or past its deadline by the time the
+     * loop gets to it. skipped tasks are destroyed unrun and counted in Stats::cancelled.
+     */
+    void enqueue(
+        callable_t &&callable,
+        handycpp::CancellationToken token,
+        Priority priority = Priority::Normal,
+        CallSite site = CallSite::current()) noexcept {
+        post(priority, Entry{std::move(callable), stamp(), site, std::move(token)}, Admission::Wait);
+    }
+
+    /**
+     * never blocks. returns false when a bounded loop is full and the task was not queued, see Options::overflow.
+     * an unbounded loop always accepts.
+     */
+    bool tryEnqueue(
+        callable_t &&callable,
+        Priority priority = Priority::Normal,
+        CallSite site = CallSite::current()) noexcept {
+        return post(priority, Entry{std::move(callable), stamp(), site}, Admission::Try);
+    }
+
+    /**
+     * queues callable even when a bounded loop is full, it never blocks and is never refused or dropped. meant for the
+     * few control tasks that must not be lost, such as a fence or a final flush, everything else should respect the
+     * capacity.
+     */
+    void enqueueForced(
+        callable_t &&callable,
+        Priority priority = Priority::Normal,
+        CallSite site = CallSite::current()) noexcept {
+        post(priority, Entry{std::move(callable), stamp(), site}, Admission::Force);
+    }
+
+    /**
+     * runs callable on the loop thread once delay has passed. timers are checked whenever the loop comes round, so a
+     * busy loop runs them between batches of tasks, never in the middle of one. a timer that has not fired yet when
+     * the loop is destroyed never runs.
+     */
+    void enqueueAfter(std::chrono::nanoseconds delay, callable_t &&callable) noexcept {
+        int64_t due = nowNs() + std::max<int64_t>(delay.count(), 0);
+        if (onLoopThread()) {
+            addTimer(due, std::move(callable));
+            return;
+        }
+        // the timer heap belongs to the loop thread, hand it over. Force: a bounded loop must not drop the timer
+        post(Priority::High,
+             Entry{[this, due, func = std::move(callable)]() mutable { addTimer(due, std::move(func)); }, 0, {}},
+             Admission::Force);
+    }
+
+    /**
+     * queues callable unless a task posted with the same key is still waiting to run, in which case callable is
+     * dropped and the pending one runs instead. returns whether callable was queued. once a keyed task has started,
+     * the next post with its key is queued again, so work posted while it runs is not lost.
+     *
+     * keys are compared by type and operator==, any type with a std::hash works. 7 and 7ul are different keys.
+     *
+     * @example
+     * \code{.cpp}
+     * // a burst of updates causes one repaint
+     * loop.enqueueUnique("repaint", [this] { repaint(); });
+     * \endcode
+     */
+    template <typename Key>
+    bool enqueueUnique(
+        const Key &key,
+        callable_t &&callable,
+        Priority priority = Priority::Normal,
+        CallSite site = CallSite::current()) noexcept {
+        return postKeyed(key, std::move(callable), false, priority, site);
+    }
+
+    /**
+     * same as enqueueUnique, but a pending task of the same key is replaced by callable, so the latest post wins.
+     * the task keeps its place in the queue.
+     */
+    template <typename Key>
+    void enqueueReplace(
+        const Key &key,
+        callable_t &&callable,
+        Priority priority = Priority::Normal,
+        CallSite site = CallSite::current()) noexcept {
+        postKeyed(key, std::move(callable), true, priority, site);
+    }
+
+    /**
+     * moves every callable of [first, last) into the queue under one lock and wakes the loop once.
+     * the callables run in order, and the range is left holding moved-from elements.
+     *
+     * @example
+     * \code{.cpp}
+     * std::vector<EventLoop::callable_t> tasks;
+     * for (auto &item : batch) {
+     *     tasks.emplace_back([&item] { process(item); });
+     * }
+     * eventLoop.enqueueBulk(tasks.begin(), tasks.end());
+     * \endcode
+     */
+    template <typename Iterator>
+    void enqueueBulk(
+        Iterator first,
+        Iterator last,
+        Priority priority = Priority::Normal,
+        CallSite site = CallSite::current()) {
+        if (first == last) {
+            return;
+        }
+        if (m_options.capacity > 0) {
+            // admission is per task, so a batch larger than the capacity can still make progress
+            for (; first != last; ++first) {
+                enqueue(std::move(*first), priority, site);
+            }
+            return;
+        }
+        Lane &lane = m_lanes[(size_t)priority];
+        int64_t now = stamp();
+        auto makeEntry = [now, site](auto &callable) { return Entry{std::move(callable), now, site}; };
+        if (m_options.lockFree) {
+            lane.pending.fetch_add((size_t)std::distance(first, last), std::memory_order_seq_cst);
+            lane.queue.pushBulk(first, last, makeEntry);
+        } else {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            for (; first != last; ++first) {
+                lane.writeBuffer.emplace_back(makeEntry(*first));
+                lane.pending.fetch_add(1, std::memory_order_relaxed);
+            }
+        }
+        trackDepth();
+        wakeIfParked();
+    }
+
+    template <typename Range>
+    void enqueueBulk(Range &&range, Priority priority = Priority::Normal, CallSite site = CallSite::current()) {
+        enqueueBulk(std::begin(range), std::end(range), priority, site);
+    }
+
+    /**
+     * enqueueSync
+     *  pass by reference supported
+     * @tparam Func
+     * @tparam Args
+     * @param callable
+     * @param args
+     * @return
+     * @example
+     * \code{.cpp}
+     * std::cout << eventLoop.enqueueSync([](const int& x, int&& y, int z)
+     * {
+     *     return x + y + z;
+     * }, 1, 2, 3);
+     * \endcode
+     */
+    template <typename Ret, typename... Args>
+    auto enqueueSync(std::function<Ret(Args...)> &&callable, Args &&...args) {
+        return syncAt(CallSite{}, std::forward<std::function<Ret(Args...)>>(callable), std::forward<Args>(args)...);
+    }
+
+    /**
+     * enqueueSync for a callable that takes no arguments, site is what the slow-task watchdog reports
+     */
+    template <typename Func> auto enqueueSync(Func &&callable, CallSite site = CallSite::current()) {
+        return syncAt(site, std::forward<Func>(callable));
+    }
+
+    /**
+     * pass by reference not supported. no default argument can follow args, so the watchdog reports these tasks
+     * without a call site; bind the arguments in a lambda to keep it.
+     * @tparam Func
+     * @tparam Args
+     * @param callable
+     * @param args
+     * @return
+     */
+    template <typename Func, typename Arg, typename... Args>
+    auto enqueueSync(Func &&callable, Arg &&arg, Args &&...args) {
+        return syncAt(CallSite{}, std::forward<Func>(callable), std::forward<Arg>(arg), std::forward<Args>(args)...);
+    }
+
+    /**
+     * enqueueAsync
+     * @tparam Func
+     * @tparam Args
+     * @param callable
+     * @param args
+     * @return std::future
+     * @example
+     * \code{.cpp}
+     * std::future<int> result = eventLoop.enqueueAsync([](int x, int y)
+     * {
+     *    return x + y;
+     * }, 1, 2);
+     * //
+     * //do some heavy work here
+     * //
+     * std::cout << result.get();
+     * \endcode
+     * like enqueueSync, only the overload without args can record the call site for the watchdog.
+     */
+    template <typename Func> [[nodiscard]] auto enqueueAsync(Func &&callable, CallSite site = CallSite::current()) {
+        return asyncAt(Priority::Normal, site, std::forward<Func>(callable));
+    }
+
+    template <typename Func, typename Arg, typename... Args>
+    [[nodiscard]] auto enqueueAsync(Func &&callable, Arg &&arg, Args &&...args) {
+        return asyncAt(
+            Priority::Normal, CallSite{}, std::forward<Func>(callable), std::forward<Arg>(arg),
+            std::forward<Args>(args)...);
+    }
+
+    template<typename Ret, typename... Args>
+    [[nodiscard]] auto enqueueAsync(std::function<Ret(Args...)>& callable, Args&& ...args)
+    {
+        return asyncAt(Priority::Normal, CallSite{}, callable, std::forward<Args>(args)...);
+    }
+
+    /**
+     * enqueueAsync on the given priority lane
+     * \code{.cpp}
+     * auto result = eventLoop.enqueueAsync(EventLoop::Priority::High, [] { return readConfig(); });
+     * \endcode
+     */
+    template <typename Func>
+    [[nodiscard]] auto enqueueAsync(Priority priority, Func &&callable, CallSite site = CallSite::current()) {
+        return asyncAt(priority, site, std::forward<Func>(callable));
+    }
+
+    template <typename Func, typename Arg, typename... Args>
+    [[nodiscard]] auto enqueueAsync(Priority priority, Func &&callable, Arg &&arg, Args &&...args) {
+        return asyncAt(
+            priority, CallSite{}, std::forward<Func>(callable), std::forward<Arg>(arg), std::forward<Args>(args)...);
+    }
+
+    /**
+     * enqueueAsync that is skipped if token is cancelled or expired before the task starts, the future then throws
+     * handycpp::TaskCancelled
+     * \code{.cpp}
+     * auto token = handycpp::CancellationToken::withTimeout(std::chrono::milliseconds(50));
+     * auto result = eventLoop.enqueueAsync(token, [] { return render(); });
+     * \endcode
+     */
+    template <typename Func>
+    [[nodiscard]] auto
+    enqueueAsync(handycpp::CancellationToken token, Func &&callable, CallSite site = CallSite::current()) {
+        return cancellableAt(std::move(token), site, std::forward<Func>(callable));
+    }
+
+    template <typename Func, typename Arg, typename... Args>
+    [[nodiscard]] auto enqueueAsync(handycpp::CancellationToken token, Func &&callable, Arg &&arg, Args &&...args) {
+        return cancellableAt(
+            std::move(token), CallSite{}, std::forward<Func>(callable), std::forward<Arg>(arg),
+            std::forward<Args>(args)...);
+    }
+
+
+    /**
+     * watches fd on the loop thread, callback runs on the loop thread with the ready events every time epoll reports
+     * the fd. events is an epoll mask such as EPOLLIN | EPOLLOUT, level triggered unless EPOLLET is given.
+     * only available when the loop was constructed with Options::io.
+     *
+     * addFd, modifyFd and removeFd may be called from any thread, they hop to the loop thread and wait for it, so
+     * once removeFd returns the callback will not be called again and fd may be closed.
+     *
+     * @return 0 on success, -1 on error and errno is set
+     * @example
+     * \code{.cpp}
+     * EventLoop::Options options;
+     * options.io = true;
+     * EventLoop loop(options);
+     * loop.addFd(sock, EPOLLIN, [sock](uint32_t events) {
+     *     char buf[4096];
+     *     ssize_t n = read(sock, buf, sizeof(buf));
+     *     // ...
+     * });
+     * \endcode
+     */
+    int addFd(int fd, uint32_t events, fd_callback_t &&callback) {
+        return inLoop([&] { return addFdInLoop(fd, events, std::move(callback)); });
+    }
+
+    int modifyFd(int fd, uint32_t events) {
+        return inLoop([&] { return modifyFdInLoop(fd, events); });
+    }
+
+    int removeFd(int fd) {
+        return inLoop([&] { return removeFdInLoop(fd); });
+    }
+
+#if defined(HANDYCPP_HAS_COROUTINES)
+    /**
+     * awaitable that resumes the coroutine on this loop's thread, see handycpp/coroutine.h for task<T>
+     * \code{.cpp}
+     * handycpp::task<> handle(EventLoop &io, EventLoop &db) {
+     *     co_await db.schedule();
+     *     auto row = query();
+     *     co_await io.schedule();
+     *     reply(row);
+     * }
+     * \endcode
+     */
+    auto schedule(Priority priority = Priority::Normal, CallSite site = CallSite::current()) noexcept {
+        struct Awaiter {
+            EventLoop &loop;
+            Priority priority;
+            CallSite site;
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::coroutine_handle<> handle) noexcept {
+                loop.enqueue([handle] { handle.resume(); }, priority, site);
+            }
+            void await_resume() const noexcept {}
+        };
+        return Awaiter{*this, priority, site};
+    }
+#endif
+
+    /**
+     * a snapshot of the loop's counters, safe to call from any thread. everything but queueDepth stays zero unless
+     * the loop was constructed with Options::instrument.
+     */
+    Stats stats() const {
+        Stats stats;
+        for (const Lane &lane : m_lanes) {
+            stats.queueDepth += lane.pending.load(std::memory_order_relaxed);
+        }
+        stats.peakQueueDepth = m_peakDepth.load(std::memory_order_relaxed);
+        stats.tasksRun = m_tasksRun.load(std::memory_order_relaxed);
+        stats.wakeups = m_wakeups.load(std::memory_order_relaxed);
+        stats.spinHits = m_spinHits.load(std::memory_order_relaxed);
+        stats.slowTasks = m_slowTasks.load(std::memory_order_relaxed);
+        stats.blocked = m_blocked.load(std::memory_order_relaxed);
+        stats.rejected = m_rejected.load(std::memory_order_relaxed);
+        stats.droppedOldest = m_droppedOldest.load(std::memory_order_relaxed);
+        stats.droppedNewest = m_droppedNewest.load(std::memory_order_relaxed);
+        stats.coalesced = m_coalesced.load(std::memory_order_relaxed);
+        stats.cancelled = m_cancelled.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < handycpp::LatencyHistogram::kBuckets; i++) {
+            stats.waitTime.buckets[i] = m_waitTime[i].load(std::memory_order_relaxed);
+            stats.waitTime.count += stats.waitTime.buckets[i];
+            stats.runTime.buckets[i] = m_runTime[i].load(std::memory_order_relaxed);
+            stats.runTime.count += stats.runTime.buckets[i];
+        }
+
+        std::lock_guard<std::mutex> guard(m_statsMutex);
+        int64_t now = nowNs();
+        if (now > m_lastStatsAt) {
+            stats.wakeupsPerSecond = (double)(stats.wakeups - m_lastStatsWakeups) * 1e9 / (double)(now - m_lastStatsAt);
+        }
+        m_lastStatsAt = now;
+        m_lastStatsWakeups = stats.wakeups;
+        return stats;
+    }
+
+    /**
+     * Options::threadless only. runs every task that is queued right now, and when there is none waits up to
+     * timeout for one to arrive and runs what arrived. a negative timeout waits as long as it takes. in io mode
+     * ready file descriptors are served as well. returns the number of tasks run.
+     *
+     * the calling thread counts as the loop thread until the next runOnce()/poll() from another thread.
+     * must not be called from inside one of this loop's own tasks.
+     */
+    size_t runOnce(std::chrono::nanoseconds timeout) noexcept {
+        m_driver.store(std::this_thread::get_id(), std::memory_order_relaxed);
+        EventLoop *outer = std::exchange(currentLoop(), this);
+        size_t ran = drain() + runTimers();
+        if (ran == 0 && timeout.count() != 0) {
+            // the spin/yield phase counts against timeout, and whatever it found runs right away
+            auto start = std::chrono::steady_clock::now();
+            if (!spinUntilQueued(timeout.count() < 0 ? std::chrono::nanoseconds::max() : timeout)) {
+                if (timeout.count() > 0) {
+                    auto spent = std::chrono::steady_clock::now() - start;
+                    timeout = std::max(std::chrono::nanoseconds(0), timeout - spent);
+                }
+                auto next = untilNextTimer();
+                if (next.count() >= 0 && (timeout.count() < 0 || next < timeout)) {
+                    timeout = next;
+                }
+                park(timeout);
+            }
+            ran = drain() + runTimers();
+        }
+#if defined(__linux__)
+        if (m_epollFd >= 0) {
+            pollFds(0);
+        }
+#endif
+        currentLoop() = outer;
+        return ran;
+    }
+
+    /**
+     * runOnce() without waiting
+     */
+    size_t poll() noexcept { return runOnce(std::chrono::nanoseconds(0)); }
+
+    /**
+     * the loop whose thread is calling, nullptr when called from a thread that is not an event loop thread
+     */
+    static EventLoop *current() noexcept { return currentLoop(); }
+
+    /**
+     * whether the calling thread is the loop thread, for a threadless loop the thread that drives it
+     */
+    bool onLoopThread() const noexcept {
+        auto self = std::this_thread::get_id();
+        return m_thread.joinable() ? self == m_thread.get_id() : self == m_driver.load(std::memory_order_relaxed);
+    }
+
+    int gettid() {
+       return tid;
+    }
+    int getpid() {
+        return pid;
+    }
+
+private:
+    static constexpr size_t kLanes = 3;
+
+    struct Entry {
+        Entry() = default;
+        Entry(callable_t &&func, int64_t enqueuedAt, CallSite site) noexcept
+            : func(std::move(func)), enqueuedAt(enqueuedAt), site(site) {}
+        Entry(callable_t &&func, int64_t enqueuedAt, CallSite site, handycpp::CancellationToken &&token) noexcept
+            : func(std::move(func)), enqueuedAt(enqueuedAt), site(site), token(std::move(token)) {}
+
+        callable_t func;
+        int64_t enqueuedAt = 0; // steady clock ns, only stamped when instrumented
+        CallSite site;
+        std::optional<handycpp::CancellationToken> token; // checked right before the task would run
+    };
+
+    struct Lane {
+        std::vector<Entry> writeBuffer; // mutex mode, guarded by m_mutex
+        size_t writeHead = 0;           // entries before it were evicted by Overflow::DropOldest
+        std::vector<Entry> readBuffer;  // mutex mode, loop thread only
+        size_t readIndex = 0;
+        handycpp::MpscQueue<Entry> queue; // lock-free mode
+        // queued but not yet started. bumped before the task becomes visible, so it never under-counts
+        std::atomic<size_t> pending{0};
+        unsigned int passedOver = 0; // loop thread only
+    };
+
+    Options m_options{};
+    // enqueueUnique/enqueueReplace: the key and callable of every keyed task that is queued but not started.
+    // declared before m_lanes, keyed tasks still queued when the loop is destroyed look themselves up here
+    struct KeyBase {
+        explicit KeyBase(size_t hash) noexcept : hash(hash) {}
+        virtual ~KeyBase() = default;
+        virtual const std::type_info &type() const noexcept = 0;
+        virtual const void *get() const noexcept = 0;
+        virtual bool equals(const void *other) const = 0; // other points to a key of the same type
+        const size_t hash;
+    };
+    // Stored is Key for the keys in m_keyed, and const Key & for lookups
+    template <typename Key, typename Stored = Key> struct KeyOf final : KeyBase {
+        explicit KeyOf(const Key &key) : KeyBase(std::hash<Key>{}(key)), key(key) {}
+        const std::type_info &type() const noexcept override { return typeid(Key); }
+        const void *get() const noexcept override { return std::addressof(key); }
+        bool equals(const void *other) const override { return key == *static_cast<const Key *>(other); }
+        Stored key;
+    };
+    struct KeyHash {
+        size_t operator()(const KeyBase *key) const noexcept { return key->hash; }
+    };
+    struct KeyEqual {
+        bool operator()(const KeyBase *a, const KeyBase *b) const {
+            return a == b || (a->type() == b->type() && a->equals(b->get()));
+        }
+    };
+    struct Keyed {
+        std::unique_ptr<KeyBase> key; // the map's key points here
+        callable_t func;
+    };
+    std::mutex m_keyedMutex{};
+    std::unordered_map<const KeyBase *, Keyed, KeyHash, KeyEqual> m_keyed;
+    std::array<Lane, kLanes> m_lanes;
+    std::atomic<bool> m_parked{false};
+    std::mutex m_mutex{};
+    std::condition_variable m_condVar{};
+#if defined(__linux__)
+    int m_eventFd{m_options.io ? ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC) : -1};
+    int m_epollFd{createEpoll(m_eventFd)};
+    // only touched on the loop thread
+    std::unordered_map<int, std::unique_ptr<fd_callback_t>> m_fdCallbacks;
+    std::vector<std::unique_ptr<fd_callback_t>> m_retiredFdCallbacks;
+#endif
+
+    // instrumentation, written by the loop thread only unless noted
+    std::atomic<size_t> m_peakDepth{0}; // written by producers
+    std::atomic<uint64_t> m_tasksRun{0};
+    std::atomic<uint64_t> m_wakeups{0};
+    std::atomic<uint64_t> m_spinHits{0};
+    std::atomic<uint64_t> m_slowTasks{0}; // written by the watchdog
+    // bounded loops, written under m_mutex
+    std::atomic<uint64_t> m_blocked{0};
+    std::atomic<uint64_t> m_rejected{0};
+    std::atomic<uint64_t> m_droppedOldest{0};
+    std::atomic<uint64_t> m_droppedNewest{0};
+    std::atomic<uint64_t> m_coalesced{0};
+    std::atomic<uint64_t> m_cancelled{0};
+    std::atomic<int> m_waitingForRoom{0};
+    std::condition_variable m_roomCond{};
+    std::array<std::atomic<uint64_t>, handycpp::LatencyHistogram::kBuckets> m_waitTime{};
+    std::array<std::atomic<uint64_t>, handycpp::LatencyHistogram::kBuckets> m_runTime{};
+    mutable std::mutex m_statsMutex{};
+    mutable int64_t m_lastStatsAt{nowNs()};
+    mutable uint64_t m_lastStatsWakeups{0};
+    // the task that is running right now, a seqlock so the watchdog never reads a torn record
+    std::atomic<uint64_t> m_runningSeq{0};
+    std::atomic<int64_t> m_runningSince{0};
+    std::atomic<const char *> m_runningFile{nullptr};
+    std::atomic<int> m_runningLine{0};
+    std::thread m_watchdog;
+    std::mutex m_watchdogMutex{};
+    std::condition_variable m_watchdogCond{};
+    bool m_watchdogStop{false};
+
+    std::chrono::nanoseconds m_spinBudget{m_options.spinFor}; // loop thread only
+
+    struct Timer {
+        int64_t due; // steady clock ns
+        uint64_t seq;
+        callable_t func;
+    };
+    std::vector<Timer> m_timers; // a min-heap on (due, seq), loop thread only
+    uint64_t m_timerSeq{0};
+
+    bool m_running{true};
+    std::thread m_thread{m_options.threadless ? std::thread() : std::thread(&EventLoop::threadFunc, this)};
+    // the thread that counts as the loop thread of a threadless loop, see runOnce()
+    std::atomic<std::thread::id> m_driver{std::this_thread::get_id()};
+
+    int tid;
+    int pid;
+
+    static EventLoop *&currentLoop() noexcept {
+        static thread_local EventLoop *loop = nullptr;
+        return loop;
+    }
+
+    void recordThreadIds() noexcept {
+#if defined(__linux__)
+        tid = (int)::gettid();
+        pid = (int)::getpid();
+        printf("--%d\n", tid);
+#elif defined(_WIN32)
+        tid = (int)GetCurrentThreadId();
+        pid = (int)GetCurrentProcessId();
+#else
+#endif
+    }
+
+    void threadFunc() noexcept {
+        currentLoop() = this;
+        if (!m_options.placement.empty()) {
+            m_options.placement.apply();
+            if (m_options.placement.numaNode >= 0) {
+                reserveBuffers();
+            }
+        }
+        recordThreadIds();
+
+        while (m_running) {
+            if (drain() + runTimers() == 0 && m_running && !spinUntilQueued()) {
+                park(untilNextTimer());
+            }
+#if defined(__linux__)
+            else if (m_epollFd >= 0 && m_running) {
+                pollFds(0); // keep fds served while tasks keep coming
+            }
+#endif
+        }
+    }
+
+    template <typename Func, typename... Args> auto syncAt(CallSite site, Func &&callable, Args &&...args) {
+        if (onLoopThread()) {
+            return std::invoke(std::forward<Func>(callable), std::forward<Args>(args)...);
+        }
+
+        return handycpp::runSync(
+            [this, site](callable_t &&task) { enqueue(std::move(task), Priority::Normal, site); },
+            std::forward<Func>(callable),
+            std::forward<Args>(args)...);
+    }
+
+    template <typename Func, typename... Args>
+    auto asyncAt(Priority priority, CallSite site, Func &&callable, Args &&...args) {
+        auto [task, future] = handycpp::makeAsyncTask(std::forward<Func>(callable), std::forward<Args>(args)...);
+        enqueue(std::move(task), priority, site);
+        return std::move(future);
+    }
+
+    template <typename Func, typename... Args>
+    auto cancellableAt(handycpp::CancellationToken token, CallSite site, Func &&callable, Args &&...args) {
+        auto [task, future] =
+            handycpp::makeCancellableTask(token, std::forward<Func>(callable), std::forward<Args>(args)...);
+        enqueue(std::move(task), std::move(token), Priority::Normal, site);
+        return std::move(future);
+    }
+
+    // the stop task rides the lowest lane behind everything queued there, and steps aside while a higher lane still
+    // holds work, so the destructor never throws away a queued task
+    void stopWhenDrained() noexcept {
+        for (size_t i = 0; i + 1 < kLanes; i++) {
+            if (m_lanes[i].pending.load(std::memory_order_relaxed) > 0) {
+                post(Priority::Background, Entry{[this] { stopWhenDrained(); }, 0, {}}, Admission::Force);
+                return;
+            }
+        }
+        m_running = false;
+    }
+
+    // first touch from the loop thread puts the buffers on its node. they only ever grow and are swapped between
+    // writeBuffer and readBuffer, so they stay there. the lock-free queues keep their node pools just the same
+    void reserveBuffers() {
+        static constexpr size_t kReserve = 1024;
+        if (m_options.lockFree) {
+            for (Lane &lane : m_lanes) {
+                lane.queue.reserve(kReserve);
+            }
+            return;
+        }
+        std::lock_guard<std::mutex> guard(m_mutex);
+        for (Lane &lane : m_lanes) {
+            lane.writeBuffer.reserve(kReserve);
+            lane.readBuffer.reserve(kReserve);
+        }
+    }
+
+    // runs the tasks that are queued right now, highest lane first. one wakeup pays for the whole batch, and tasks
+    // posted meanwhile wait for the next round so fds get polled in between.
+    size_t drain() noexcept {
+        size_t budget = 0;
+        for (Lane &lane : m_lanes) {
+            budget += lane.pending.load(std::memory_order_relaxed);
+        }
+
+        size_t ran = 0;
+        Entry entry;
+        while (m_running && budget > 0) {
+            Lane *lane = nextLane();
+            if (lane == nullptr) {
+                break;
+            }
+            if (!take(*lane, entry)) {
+                std::this_thread::yield(); // a lock-free producer is half way through push()
+                continue;
+            }
+            budget--;
+            if (entry.token) {
+                bool skip = entry.token->cancelled();
+                entry.token.reset();
+                if (skip) {
+                    entry.func = nullptr; // a cancellable async task fails its future with TaskCancelled here
+                    m_cancelled.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+            }
+            if (instrumented()) {
+                runInstrumented(entry);
+            } else {
+                entry.func();
+            }
+            entry.func = nullptr;
+            ran++;
+        }
+        return ran;
+    }
+
+    enum class Admission { Wait, Try, Force };
+
+    static bool laterTimer(const Timer &a, const Timer &b) noexcept {
+        return a.due != b.due ? a.due > b.due : a.seq > b.seq;
+    }
+
+    void addTimer(int64_t due, callable_t &&func) noexcept {
+        m_timers.push_back(Timer{due, m_timerSeq++, std::move(func)});
+        std::push_heap(m_timers.begin(), m_timers.end(), laterTimer);
+    }
+
+    // runs the timers that are due, a timer armed meanwhile waits for the next round even if it is due already
+    size_t runTimers() noexcept {
+        if (m_timers.empty()) {
+            return 0;
+        }
+        int64_t now = nowNs();
+        std::vector<callable_t> due;
+        while (!m_timers.empty() && m_timers.front().due <= now) {
+            std::pop_heap(m_timers.begin(), m_timers.end(), laterTimer);
+            due.push_back(std::move(m_timers.back().func));
+            m_timers.pop_back();
+        }
+        for (auto &func : due) {
+            if (m_running) {
+                func();
+            }
+        }
+        return due.size();
+    }
+
+    // negative when no timer is armed
+    std::chrono::nanoseconds untilNextTimer() const noexcept {
+        if (m_timers.empty()) {
+            return std::chrono::nanoseconds(-1);
+        }
+        return std::chrono::nanoseconds(std::max<int64_t>(m_timers.front().due - nowNs(), 0));
+    }
+
+    // what actually sits in the queue for a keyed task: it looks the callable up when it runs, and forgets the key
+    // when it is destroyed unrun, e.g. dropped by a bounded loop
+    struct KeyedTask {
+        EventLoop *loop;
+        const KeyBase *key; // owned by the m_keyed entry, which lives until takeKeyed
+        KeyedTask(EventLoop *loop, const KeyBase *key) noexcept : loop(loop), key(key) {}
+        KeyedTask(KeyedTask &&other) noexcept : loop(std::exchange(other.loop, nullptr)), key(other.key) {}
+        ~KeyedTask() {
+            if (loop != nullptr) {
+                loop->takeKeyed(key);
+            }
+        }
+        void operator()() {
+            callable_t func = std::exchange(loop, nullptr)->takeKeyed(key);
+            if (func) {
+                func();
+            }
+        }
+    };
+
+    callable_t takeKeyed(const KeyBase *key) noexcept {
+        Keyed keyed; // the key is freed after the lock is released
+        {
+            std::lock_guard<std::mutex> guard(m_keyedMutex);
+            auto it = m_keyed.find(key);
+            if (it == m_keyed.end()) {
+                return nullptr;
+            }
+            keyed = std::move(it->second);
+            m_keyed.erase(it);
+        }
+        return std::move(keyed.func);
+    }
+
+    template <typename Key>
+    bool postKeyed(const Key &key, callable_t &&callable, bool replace, Priority priority, CallSite site) noexcept {
+        callable_t replaced; // destroyed after the lock is released
+        const KeyBase *stored = nullptr;
+        {
+            KeyOf<Key, const Key &> probe(key);
+            std::lock_guard<std::mutex> guard(m_keyedMutex);
+            auto it = m_keyed.find(&probe);
+            if (it != m_keyed.end()) {
+                m_coalesced.fetch_add(1, std::memory_order_relaxed);
+                if (!replace) {
+                    return false;
+                }
+                replaced = std::exchange(it->second.func, std::move(callable));
+                return true;
+            }
+            auto owned = std::make_unique<KeyOf<Key>>(key);
+            stored = owned.get();
+            m_keyed.emplace(stored, Keyed{std::move(owned), std::move(callable)});
+        }
+        return post(priority, Entry{KeyedTask(this, stored), stamp(), site}, Admission::Wait);
+    }
+
+    static Options sanitize(Options options) {
+        if (options.capacity > 0) {
+            options.lockFree = false;
+        }
+        return options;
+    }
+
+    size_t queued() const noexcept {
+        size_t depth = 0;
+        for (const Lane &lane : m_lanes) {
+            depth += lane.pending.load(std::memory_order_seq_cst);
+        }
+        return depth;
+    }
+
+    bool post(Priority priority, Entry &&entry, Admission admission) noexcept {
+        Lane &lane = m_lanes[(size_t)priority];
+        if (m_options.lockFree) {
+            lane.pending.fetch_add(1, std::memory_order_seq_cst);
+            lane.queue.push(std::move(entry));
+        } else {
+            Entry evicted; // destroyed after the lock is released, its captures may post to this loop again
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_options.capacity > 0 && admission != Admission::Force && !admit(lane, lock, admission, evicted)) {
+                return false;
+            }
+            lane.writeBuffer.emplace_back(std::move(entry));
+            lane.pending.fetch_add(1, std::memory_order_relaxed);
+        }
+        trackDepth();
+        wakeIfParked();
+        return true;
+    }
+
+    // called with m_mutex held when the loop is bounded, false means the new task must not be queued
+    bool admit(Lane &lane, std::unique_lock<std::mutex> &lock, Admission admission, Entry &evicted) noexcept {
+        if (queued() < m_options.capacity) {
+            return true;
+        }
+        switch (m_options.overflow) {
+        case Overflow::Block:
+            if (admission == Admission::Try) {
+                m_rejected.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+            if (onLoopThread()) {
+                return true;
+            }
+            m_blocked.fetch_add(1, std::memory_order_relaxed);
+            m_waitingForRoom.fetch_add(1, std::memory_order_seq_cst);
+            m_roomCond.wait(lock, [this] { return queued() < m_options.capacity; });
+            m_waitingForRoom.fetch_sub(1, std::memory_order_relaxed);
+            return true;
+        case Overflow::Fail:
+            m_rejected.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case Overflow::DropOldest:
+            // only what the loop thread has not claimed yet can be evicted
+            if (lane.writeHead < lane.writeBuffer.size()) {
+                evicted = std::move(lane.writeBuffer[lane.writeHead++]);
+                lane.pending.fetch_sub(1, std::memory_order_relaxed);
+                m_droppedOldest.fetch_add(1, std::memory_order_relaxed);
+                if (lane.writeHead * 2 >= lane.writeBuffer.size()) {
+                    // compact, so the evicted shells do not pile up while the loop thread is busy
+                    lane.writeBuffer.erase(lane.writeBuffer.begin(), lane.writeBuffer.begin() + (ptrdiff_t)lane.writeHead);
+                    lane.writeHead = 0;
+                }
+                return true;
+            }
+            m_droppedNewest.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        case Overflow::DropNewest:
+            m_droppedNewest.fetch_add(1, std::memory_order_relaxed);
+            return false;
+        }
+        return true;
+    }
+
+    bool instrumented() const noexcept {
+        return m_options.instrument || m_options.slowTaskThreshold.count() > 0;
+    }
+
+    static int64_t nowNs() noexcept {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    int64_t stamp() const noexcept { return instrumented() ? nowNs() : 0; }
+
+    void trackDepth() noexcept {
+        if (!m_options.instrument) {
+            return;
+        }
+        size_t depth = 0;
+        for (const Lane &lane : m_lanes) {
+            depth += lane.pending.load(std::memory_order_relaxed);
+        }
+        size_t peak = m_peakDepth.load(std::memory_order_relaxed);
+        while (depth > peak && !m_peakDepth.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    static void bump(std::atomic<uint64_t> &counter) noexcept {
+        counter.store(counter.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    }
+
+    void publishRunning(int64_t since, const CallSite &site) noexcept {
+        uint64_t seq = m_runningSeq.load(std::memory_order_relaxed);
+        m_runningSeq.store(seq + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        m_runningSince.store(since, std::memory_order_relaxed);
+        m_runningFile.store(site.file, std::memory_order_relaxed);
+        m_runningLine.store(site.line, std::memory_order_relaxed);
+        m_runningSeq.store(seq + 2, std::memory_order_release);
+    }
+
+    void runInstrumented(Entry &entry) noexcept {
+        int64_t start = nowNs();
+        publishRunning(start, entry.site);
+        entry.func();
+        int64_t end = nowNs();
+        publishRunning(0, {});
+        if (m_options.instrument) {
+            bump(m_waitTime[handycpp::LatencyHistogram::bucketOf(std::chrono::nanoseconds(start - entry.enqueuedAt))]);
+            bump(m_runTime[handycpp::LatencyHistogram::bucketOf(std::chrono::nanoseconds(end - start))]);
+            bump(m_tasksRun);
+        }
+    }
+
+    void watchdogFunc() noexcept {
+        auto interval = std::max<std::chrono::nanoseconds>(m_options.slowTaskThreshold / 4, std::chrono::milliseconds(1));
+        uint64_t reported = 0;
+        std::unique_lock<std::mutex> lock(m_watchdogMutex);
+        while (!m_watchdogCond.wait_for(lock, interval, [this] { return m_watchdogStop; })) {
+            uint64_t seq = m_runningSeq.load(std::memory_order_acquire);
+            if (seq & 1 || seq == reported) {
+                continue;
+            }
+            int64_t since = m_runningSince.load(std::memory_order_relaxed);
+            SlowTask slow{{m_runningFile.load(std::memory_order_relaxed), m_runningLine.load(std::memory_order_relaxed)},
+                          std::chrono::nanoseconds(nowNs() - since)};
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (m_runningSeq.load(std::memory_order_relaxed) != seq || since == 0 ||
+                slow.running < m_options.slowTaskThreshold) {
+                continue;
+            }
+            reported = seq;
+            m_slowTasks.fetch_add(1, std::memory_order_relaxed);
+            if (m_options.onSlowTask) {
+                m_options.onSlowTask(slow);
+            } else {
+                fprintf(
+                    stderr,
+                    "EventLoop: task enqueued at %s:%d has been running for %lldms\n",
+                    slow.site.file != nullptr ? slow.site.file : "?",
+                    slow.site.line,
+                    (long long)std::chrono::duration_cast<std::chrono::milliseconds>(slow.running).count());
+            }
+        }
+    }
+
+    Lane *nextLane() noexcept {
+        size_t chosen = kLanes;
+        for (size_t i = 0; i < kLanes; i++) {
+            if (m_lanes[i].pending.load(std::memory_order_relaxed) > 0) {
+                chosen = i;
+                break;
+            }
+        }
+        if (chosen == kLanes) {
+            return nullptr;
+        }
+        for (size_t i = kLanes - 1; i > chosen; i--) {
+            if (m_lanes[i].passedOver >= m_options.starvationLimit &&
+                m_lanes[i].pending.load(std::memory_order_relaxed) > 0) {
+                chosen = i;
+                break;
+            }
+        }
+        for (size_t i = chosen + 1; i < kLanes; i++) {
+            bool waiting = m_lanes[i].pending.load(std::memory_order_relaxed) > 0;
+            m_lanes[i].passedOver = waiting ? m_lanes[i].passedOver + 1 : 0;
+        }
+        m_lanes[chosen].passedOver = 0;
+        return &m_lanes[chosen];
+    }
+
+    bool take(Lane &lane, Entry &out) noexcept {
+        if (m_options.lockFree) {
+            if (!lane.queue.pop(out)) {
+                return false;
+            }
+        } else {
+            if (lane.readIndex == lane.readBuffer.size()) {
+                lane.readBuffer.clear();
+                lane.readIndex = 0;
+                std::lock_guard<std::mutex> guard(m_mutex);
+                std::swap(lane.readBuffer, lane.writeBuffer);
+                std::swap(lane.readIndex, lane.writeHead);
+            }
+            if (lane.readIndex == lane.readBuffer.size()) {
+                return false;
+            }
+            out = std::move(lane.readBuffer[lane.readIndex++]);
+        }
+        lane.pending.fetch_sub(1, std::memory_order_seq_cst);
+        if (m_options.capacity > 0 && m_waitingForRoom.load(std::memory_order_seq_cst) > 0) {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_roomCond.notify_one();
+        }
+        return true;
+    }
+
+    bool hasQueued() const {
+        for (const Lane &lane : m_lanes) {
+            if (lane.pending.load(std::memory_order_relaxed) > 0) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    static void cpuRelax() noexcept {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+        asm volatile("yield");
+#endif
+    }
+
+    // the spin and yield phases of Options::spinFor / yieldFor. returns true when work showed up, false when the
+    // loop should park.
+    // spins, then yields, for at most limit in total
+    bool spinUntilQueued(std::chrono::nanoseconds limit = std::chrono::nanoseconds::max()) noexcept {
+        const auto spinFor = m_options.spinFor;
+        if (spinFor.count() <= 0 && m_options.yieldFor.count() <= 0) {
+            return false;
+        }
+        auto found = [this, spinFor] {
+            m_spinBudget = std::min(spinFor, m_spinBudget * 2);
+            if (m_options.instrument) {
+                bump(m_spinHits);
+            }
+            return true;
+        };
+
+        // on a single cpu the producer can not run while we spin, so only the yield phase makes sense there
+        static const bool multiCore = std::thread::hardware_concurrency() > 1;
+        const auto budget = std::min(multiCore ? m_spinBudget : std::chrono::nanoseconds(0), limit);
+        const auto yieldUntil = budget + std::min(m_options.yieldFor, limit - budget);
+        const auto start = std::chrono::steady_clock::now();
+        auto elapsed = std::chrono::nanoseconds(0);
+        while (elapsed < budget) {
+            for (int i = 0; i < 64; i++) {
+                if (hasQueued()) {
+                    return found();
+                }
+                cpuRelax();
+            }
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+        while (elapsed < yieldUntil) {
+            if (hasQueued()) {
+                return found();
+            }
+#if defined(__linux__)
+            if (m_epollFd >= 0) {
+                pollFds(0);
+            }
+#endif
+            std::this_thread::yield();
+            elapsed = std::chrono::steady_clock::now() - start;
+        }
+
+        m_spinBudget = std::max(m_spinBudget / 2, spinFor / 16);
+        return false;
+    }
+
+    // the consumer half of the parking handshake: m_parked is published before the queue is checked for the last
+    // time, and the seq_cst fence pairs with the one in wakeIfParked, so a concurrent enqueue is never missed.
+    // a negative timeout waits until there is work
+    void park(std::chrono::nanoseconds timeout = std::chrono::nanoseconds(-1)) noexcept {
+#if defined(__linux__)
+        if (m_epollFd >= 0) {
+            int timeoutMs = -1;
+            if (timeout.count() >= 0) {
+                auto ms = std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+                timeoutMs = (int)std::min<int64_t>(ms, INT_MAX);
+            }
+            m_parked.store(true, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            pollFds(hasQueued() ? 0 : timeoutMs);
+            m_parked.store(false, std::memory_order_relaxed);
+            if (m_options.instrument) {
+                bump(m_wakeups);
+            }
+            return;
+        }
+#endif
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_parked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (timeout.count() < 0) {
+            m_condVar.wait(lock, [this] { return hasQueued(); });
+        } else {
+            m_condVar.wait_for(lock, timeout, [this] { return hasQueued(); });
+        }
+        m_parked.store(false, std::memory_order_relaxed);
+        if (m_options.instrument) {
+            bump(m_wakeups);
+        }
+    }
+
+    // the producer half of the parking handshake: either the producer sees m_parked or the consumer sees the new task
+    // before it waits.
+    void wakeIfParked() noexcept {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (!m_parked.load(std::memory_order_relaxed)) {
+            return;
+        }
+#if defined(__linux__)
+        if (m_eventFd >= 0) {
+            uint64_t one = 1;
+            [[maybe_unused]] auto ret = ::write(m_eventFd, &one, sizeof(one));
+            return;
+        }
+#endif
+        std::lock_guard<std::mutex> guard(m_mutex);
+        m_condVar.notify_one();
+    }
+
+    template <typename Func> int inLoop(Func &&func) {
+#if defined(__linux__)
+        if (m_epollFd < 0) {
+            errno = ENOTSUP;
+            return -1;
+        }
+        if (onLoopThread()) {
+            return func();
+        }
+        int err = 0;
+        int ret = enqueueSync([&] {
+            int r = func();
+            err = errno;
+            return r;
+        });
+        errno = err;
+        return ret;
+#else
+        (void)func;
+        errno = ENOTSUP;
+        return -1;
+#endif
+    }
+
+#if defined(__linux__)
+    static int createEpoll(int eventFd) {
+        if (eventFd < 0) {
+            return -1;
+        }
+        int epollFd = ::epoll_create1(EPOLL_CLOEXEC);
+        if (epollFd < 0) {
+            return -1;
+        }
+        epoll_event event{};
+        event.events = EPOLLIN;
+        event.data.fd = eventFd;
+        ::epoll_ctl(epollFd, EPOLL_CTL_ADD, eventFd, &event);
+        return epollFd;
+    }
+
+    int addFdInLoop(int fd, uint32_t events, fd_callback_t &&callback) {
+        if (fd == m_eventFd || m_fdCallbacks.count(fd) != 0) {
+            errno = EEXIST;
+            return -1;
+        }
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        if (::epoll_ctl(m_epollFd, EPOLL_CTL_ADD, fd, &event) < 0) {
+            return -1;
+        }
+        m_fdCallbacks[fd] = std::make_unique<fd_callback_t>(std::move(callback));
+        return 0;
+    }
+
+    int modifyFdInLoop(int fd, uint32_t events) {
+        if (m_fdCallbacks.count(fd) == 0) {
+            errno = ENOENT;
+            return -1;
+        }
+        epoll_event event{};
+        event.events = events;
+        event.data.fd = fd;
+        return ::epoll_ctl(m_epollFd, EPOLL_CTL_MOD, fd, &event);
+    }
+
+    int removeFdInLoop(int fd) {
+        auto it = m_fdCallbacks.find(fd);
+        if (it == m_fdCallbacks.end()) {
+            errno = ENOENT;
+            return -1;
+        }
+        // the callback may be the one removing itself, keep it alive until the current dispatch round is over
+        m_retiredFdCallbacks.emplace_back(std::move(it->second));
+        m_fdCallbacks.erase(it);
+        ::epoll_ctl(m_epollFd, EPOLL_CTL_DEL, fd, nullptr);
+        return 0;
+    }
+
+    void pollFds(int timeoutMs) noexcept {
+        epoll_event events[64];
+        int n = ::epoll_wait(m_epollFd, events, 64, timeoutMs);
+        for (int i = 0; i < n; i++) {
+            int fd = events[i].data.fd;
+            if (fd == m_eventFd) {
+                uint64_t count;
+                [[maybe_unused]] auto ret = ::read(m_eventFd, &count, sizeof(count));
+                continue;
+            }
+            auto it = m_fdCallbacks.find(fd);
+            if (it != m_fdCallbacks.end()) {
+                (*it->second)(events[i].events); // removed earlier in this round means not found
+            }
+        }
+        m_retiredFdCallbacks.clear();
+    }
+#endif
+};
+
+#ifdef HANDYCPP_TEST
+#include <string>
+#include "doctest/doctest.h"
+#endif
+
+#ifdef HANDYCPP_TEST
+TEST_CASE("handycpp::event_loop") {
+    std::unique_ptr<EventLoop> loop = std::make_unique<EventLoop>();
+
+    std::function<int(int, int)> f = [](int x, int y) -> int {
+        return x+ y;
+    };
+    std::future result = loop->enqueueAsync(f, 1, 2);
+    CHECK((result.get() == 3));
+
+
+    int a = 2 , b = 3;
+    std::future result1 = loop->enqueueAsync([&]() { a=b; });
+    result1.wait();
     CHECK_EQ(a, b);
 }
+
+TEST_CASE("handycpp::event_loop lock free queue") {
+    EventLoop::Options options;
+    options.lockFree = true;
+    auto loop = std::make_unique<EventLoop>(options);
+
+    constexpr int producers = 8;
+    constexpr int tasksPerProducer = 10000;
+    int count = 0;
+    std::vector<std::thread> threads;
+    for (int i = 0; i < producers; i++) {
+        threads.emplace_back([&] {
+            for (int j = 0; j < tasksPerProducer; j++) {
+                loop->enqueue([&] { count++; });
+            }
+        });
+    }
+    for (auto &t : threads) {
+        t.join();
+    }
+    CHECK_EQ(loop->enqueueSync([&] { return count; }), producers * tasksPerProducer);
+
+    std::future result = loop->enqueueAsync([](int x, int y) { return x * y; }, 6, 7);
+    CHECK_EQ(result.get(), 42);
+
+    // nodes go back to the pool on pop, values still queued are destroyed with the queue
+    auto tracked = std::make_shared<int>(0);
+    {
+        handycpp::MpscQueue<std::shared_ptr<int>> queue;
+        std::shared_ptr<int> out;
+        for (int round = 0; round < 1000; round++) {
+            for (int i = 0; i < 10; i++) {
+                queue.push(std::shared_ptr<int>(tracked));
+            }
+            for (int i = 0; i < 10; i++) {
+                REQUIRE(queue.pop(out));
+            }
+        }
+        CHECK(queue.empty());
+        queue.push(std::shared_ptr<int>(tracked));
+        queue.push(std::shared_ptr<int>(tracked));
+        out.reset();
+        CHECK_EQ(tracked.use_count(), 3);
+    }
+    CHECK_EQ(tracked.use_count(), 1);
+
+    // reserve() grows the pool up front, its nodes serve pushes like any other
+    handycpp::MpscQueue<int> reserved;
+    reserved.reserve(1000);
+    for (int i = 0; i < 1500; i++) {
+        reserved.push(int(i));
+    }
+    int value = -1;
+    bool ordered = true;
+    for (int i = 0; i < 1500; i++) {
+        ordered = reserved.pop(value) && value == i && ordered;
+    }
+    CHECK(ordered);
+    CHECK(reserved.empty());
+}
+
+TEST_CASE("handycpp::event_loop enqueue bulk") {
+    for (bool lockFree : {false, true}) {
+        EventLoop::Options options;
+        options.lockFree = lockFree;
+        auto loop = std::make_unique<EventLoop>(options);
+
+        std::vector<int> order;
+        std::vector<EventLoop::callable_t> tasks;
+        for (int i = 0; i < 10000; i++) {
+            tasks.emplace_back([&order, i] { order.push_back(i); });
+        }
+        loop->enqueueBulk(tasks);
+
+        std::vector<std::function<void()>> more;
+        more.emplace_back([&order] { order.push_back(-1); });
+        loop->enqueueBulk(more.begin(), more.end());
+
+        loop->enqueueSync([] {});
+        REQUIRE_EQ(order.size(), 10001u);
+        bool inOrder = true;
+        for (int i = 0; i < 10000; i++) {
+            inOrder = inOrder && order[i] == i;
+        }
+        CHECK(inOrder);
+        CHECK_EQ(order.back(), -1);
+    }
+}
+
+#if defined(__linux__)
+TEST_CASE("handycpp::event_loop fd readiness") {
+    EventLoop plain;
+    CHECK_EQ(plain.addFd(0, EPOLLIN, [](uint32_t) {}), -1);
+
+    for (bool lockFree : {false, true}) {
+        EventLoop::Options options;
+        options.io = true;
+        options.lockFree = lockFree;
+        auto loop = std::make_unique<EventLoop>(options);
+
+        int fds[2];
+        REQUIRE_EQ(::pipe(fds), 0);
+        std::string received;
+        std::thread::id callbackThread;
+        CHECK_EQ(loop->addFd(fds[0], EPOLLIN, [&, fd = fds[0]](uint32_t events) {
+            char buf[64];
+            ssize_t n = ::read(fd, buf, sizeof(buf));
+            if ((events & EPOLLIN) && n > 0) {
+                received.append(buf, (size_t)n);
+            }
+            callbackThread = std::this_thread::get_id();
+        }), 0);
+        CHECK_EQ(loop->addFd(fds[0], EPOLLIN, [](uint32_t) {}), -1);
+        CHECK_EQ(errno, EEXIST);
+
+        REQUIRE_EQ(::write(fds[1], "ping", 4), 4);
+        std::string seen;
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+        while (seen != "ping" && std::chrono::steady_clock::now() < deadline) {
+            seen = loop->enqueueSync([&] { return received; });
+        }
+        CHECK_EQ(seen, "ping");
+        CHECK(loop->enqueueSync([&] { return callbackThread == std::this_thread::get_id(); }));
+
+        // tasks still get through while parked in epoll_wait
+        int count = 0;
+        std::vector<std::thread> producers;
+        for (int i = 0; i < 4; i++) {
+            producers.emplace_back([&] {
+                for (int j = 0; j < 1000; j++) {
+                    loop->enqueue([&] { count++; });
+                }
+            });
+        }
+        for (auto &t : producers) {
+            t.join();
+        }
+        CHECK_EQ(loop->enqueueSync([&] { return count; }), 4000);
+
+        CHECK_EQ(loop->removeFd(fds[0]), 0);
+        CHECK_EQ(loop->removeFd(fds[0]), -1);
+        REQUIRE_EQ(::write(fds[1], "pong", 4), 4);
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK_EQ(loop->enqueueSync([&] { return received; }), "ping");
+
+        loop = nullptr;
+        ::close(fds[0]);
+        ::close(fds[1]);
+    }
+}
+#endif
+
+TEST_CASE("handycpp::event_loop destructor drains every lane") {
+    // by default background work waits for the normal lane, with a starvation limit of 1 the stop task gets picked
+    // while normal work is still queued
+    for (unsigned int limit : {EventLoop::Options{}.starvationLimit, 1u}) {
+        EventLoop::Options options;
+        options.lockFree = limit == 1;
+        options.starvationLimit = limit;
+        auto loop = std::make_unique<EventLoop>(options);
+
+        std::promise<void> gate;
+        std::shared_future<void> opened = gate.get_future().share();
+        loop->enqueue([opened] { opened.wait(); });
+        std::atomic<int> background{0}, normal{0};
+        std::vector<std::future<void>> results;
+        for (int i = 0; i < 5; i++) {
+            results.push_back(loop->enqueueAsync(EventLoop::Priority::Background, [&] { background++; }));
+        }
+        for (int i = 0; i < 20; i++) {
+            loop->enqueue([&] { normal++; });
+        }
+        std::thread opener([&] {
+            std::this_thread::sleep_for(std::chrono::milliseconds(20)); // let the destructor queue its stop task
+            gate.set_value();
+        });
+        loop = nullptr;
+        opener.join();
+        CHECK_EQ(background.load(), 5);
+        CHECK_EQ(normal.load(), 20);
+        for (auto &result : results) {
+            CHECK_NOTHROW(result.get());
+        }
+    }
+}
+
+TEST_CASE("handycpp::event_loop priority lanes") {
+    for (bool lockFree : {false, true}) {
+        EventLoop::Options options;
+        options.lockFree = lockFree;
+        options.starvationLimit = 4;
+        auto loop = std::make_unique<EventLoop>(options);
+
+        // hold the loop so everything below is queued before anything runs
+        std::promise<void> gate;
+        std::promise<void> started;
+        std::shared_future<void> opened = gate.get_future().share();
+        loop->enqueue([opened, &started] {
+            started.set_value();
+            opened.wait();
+        });
+        started.get_future().wait();
+
+        std::vector<std::string> order;
+        for (int i = 0; i < 20; i++) {
+            loop->enqueue([&order] { order.emplace_back("n"); });
+        }
+        loop->enqueue([&order] { order.emplace_back("b"); }, EventLoop::Priority::Background);
+        for (int i = 0; i < 10; i++) {
+            loop->enqueue([&order] { order.emplace_back("h"); }, EventLoop::Priority::High);
+        }
+        auto high = loop->enqueueAsync(EventLoop::Priority::High, [&order] {
+            order.emplace_back("h");
+            return order.size();
+        });
+        gate.set_value();
+
+        // high tasks go first, but every lane that was passed over starvationLimit times gets one turn
+        CHECK_EQ(high.get(), 14u);
+        loop->enqueueSync([] {});
+        REQUIRE_EQ(order.size(), 32u);
+        std::string got;
+        for (auto &o : order) {
+            got += o;
+        }
+        CHECK_EQ(got, "hhhhbnhhhhnhhh" + std::string(18, 'n'));
+    }
+}
+
+TEST_CASE("handycpp::event_loop instrumentation") {
+    EventLoop::Options options;
+    options.instrument = true;
+    auto loop = std::make_unique<EventLoop>(options);
+
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    loop->enqueue([opened] { opened.wait(); });
+    for (int i = 0; i < 100; i++) {
+        loop->enqueue([] {});
+    }
+    CHECK_GE(loop->stats().queueDepth, 100u);
+    gate.set_value();
+
+    loop->enqueue([] { std::this_thread::sleep_for(std::chrono::milliseconds(100)); }); // a lower bound, not a window
+    loop->enqueueSync([] {});
+
+    auto stats = loop->stats();
+    CHECK_EQ(stats.queueDepth, 0u);
+    CHECK_GE(stats.peakQueueDepth, 100u);
+    CHECK_GE(stats.tasksRun, 102u);
+    CHECK_EQ(stats.waitTime.count, stats.tasksRun);
+    CHECK_EQ(stats.runTime.count, stats.tasksRun);
+    CHECK_GE(stats.runTime.percentile(100), std::chrono::microseconds(100'000));
+
+    // an idle loop parks and the next post wakes it. a post can land before the loop gets to park, so try again
+    for (int i = 0; i < 1000 && loop->stats().wakeups == 0; i++) {
+        loop->enqueueSync([] {});
+        std::this_thread::yield();
+    }
+    CHECK_GE(loop->stats().wakeups, 1u);
+}
+
+TEST_CASE("handycpp::event_loop slow task watchdog") {
+    // every slow task holds the loop until the watchdog has reported it, so no report depends on how long anything
+    // took. only these tasks run on the loop, a task that merely got preempted can not be reported instead
+    std::mutex slowMutex;
+    std::condition_variable reported;
+    std::vector<EventLoop::SlowTask> slow;
+    EventLoop::Options options;
+    options.slowTaskThreshold = std::chrono::milliseconds(20);
+    options.onSlowTask = [&](const EventLoop::SlowTask &task) {
+        std::lock_guard<std::mutex> guard(slowMutex);
+        slow.push_back(task);
+        reported.notify_all();
+    };
+    auto loop = std::make_unique<EventLoop>(options);
+    auto untilReported = [&](size_t count) {
+        return [&, count] {
+            std::unique_lock<std::mutex> lock(slowMutex);
+            reported.wait(lock, [&] { return slow.size() >= count; });
+        };
+    };
+
+    int slowLine = __LINE__ + 1;
+    loop->enqueue(untilReported(1));
+    // the wrappers report where they were called from, not where they call enqueue
+    int asyncLine = __LINE__ + 1;
+    auto slowAsync = loop->enqueueAsync(untilReported(2));
+    slowAsync.get();
+    int syncLine = __LINE__ + 1;
+    loop->enqueueSync(untilReported(3));
+
+    CHECK_EQ(loop->stats().slowTasks, 3u);
+    std::lock_guard<std::mutex> guard(slowMutex);
+    REQUIRE_EQ(slow.size(), 3u);
+    CHECK_EQ(slow[0].site.line, slowLine);
+    CHECK(std::string(slow[0].site.file).find("event_loop.h") != std::string::npos);
+    CHECK_GE(slow[0].running, std::chrono::milliseconds(20));
+    CHECK_EQ(slow[1].site.line, asyncLine);
+    CHECK_EQ(slow[2].site.line, syncLine);
+}
+
+TEST_CASE("handycpp::event_loop spin wait") {
+    EventLoop::Options options;
+    options.instrument = true;
+    options.spinFor = std::chrono::milliseconds(50);
+    options.yieldFor = std::chrono::hours(1); // so long that no hop below can outlast it
+    auto spinning = std::make_unique<EventLoop>(options);
+
+    // ping-pong between a spinning loop and the test thread. after the first hop the loop never parks again, every
+    // hop is picked up by spinning or already queued when the previous one finishes
+    int hops = spinning->enqueueAsync([] { return 1; }).get();
+    auto before = spinning->stats();
+    for (int i = 1; i < 1000; i++) {
+        hops = spinning->enqueueAsync([hops] { return hops + 1; }).get();
+    }
+    CHECK_EQ(hops, 1000);
+    auto after = spinning->stats();
+    CHECK_EQ(after.wakeups, before.wakeups);
+    CHECK_GT(after.spinHits, before.spinHits);
+    spinning = nullptr;
+
+    // a loop that spins briefly parks once it goes quiet, and posting to it still wakes it up
+    options.spinFor = std::chrono::microseconds(1);
+    options.yieldFor = std::chrono::microseconds(1);
+    auto parking = std::make_unique<EventLoop>(options);
+    CHECK_EQ(parking->enqueueAsync([] { return 7; }).get(), 7);
+    for (int i = 0; i < 1000 && parking->stats().wakeups == 0; i++) {
+        CHECK_EQ(parking->enqueueAsync([] { return 7; }).get(), 7);
+        std::this_thread::yield();
+    }
+    CHECK_GE(parking->stats().wakeups, 1u);
+}
+
+TEST_CASE("handycpp::event_loop enqueue sync") {
+    auto loop = std::make_unique<EventLoop>();
+
+    // results are moved out, exceptions are rethrown on the calling thread
+    auto owned = loop->enqueueSync([] { return std::make_unique<int>(5); });
+    CHECK_EQ(*owned, 5);
+    CHECK_THROWS_AS(loop->enqueueSync([]() -> int { throw std::runtime_error("boom"); }), std::runtime_error);
+    int value = 1;
+    loop->enqueueSync([](int &v, int add) { v += add; }, value, 2);
+    CHECK_EQ(value, 3);
+
+    // many callers blocking on the same loop at once
+    int counter = 0;
+    std::vector<std::thread> callers;
+    for (int t = 0; t < 4; t++) {
+        callers.emplace_back([&] {
+            for (int i = 0; i < 10000; i++) {
+                loop->enqueueSync([&] { counter++; });
+            }
+        });
+    }
+    for (auto &caller : callers) {
+        caller.join();
+    }
+    CHECK_EQ(loop->enqueueSync([&] { return counter; }), 40000);
+}
+
+TEST_CASE("handycpp::event_loop bounded queue") {
+    auto makeLoop = [](EventLoop::Overflow overflow) {
+        EventLoop::Options options;
+        options.capacity = 4;
+        options.overflow = overflow;
+        return std::make_unique<EventLoop>(options);
+    };
+    // parks the loop thread until the returned promise is fulfilled, so the queue can be filled up
+    auto hold = [](EventLoop &loop) {
+        auto gate = std::make_shared<std::promise<void>>();
+        std::promise<void> started;
+        auto running = started.get_future();
+        loop.enqueue([opened = gate->get_future().share(), &started] {
+            started.set_value();
+            opened.wait();
+        });
+        running.wait();
+        return gate;
+    };
+    // waits until everything queued has run, without risking the sync call being refused
+    auto settle = [](EventLoop &loop) {
+        while (loop.stats().queueDepth > 0) {
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        loop.enqueueSync([] {});
+    };
+
+    {
+        auto loop = makeLoop(EventLoop::Overflow::Block);
+        auto gate = hold(*loop);
+        std::atomic<int> ran{0};
+        for (int i = 0; i < 4; i++) {
+            CHECK(loop->tryEnqueue([&] { ran++; }));
+        }
+        CHECK_FALSE(loop->tryEnqueue([&] { ran++; }));
+
+        std::atomic<bool> posted{false};
+        std::thread producer([&] {
+            loop->enqueue([&] { ran++; });
+            posted = true;
+        });
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        CHECK_FALSE(posted.load());
+        gate->set_value();
+        producer.join();
+        settle(*loop);
+        CHECK_EQ(ran.load(), 5);
+        auto stats = loop->stats();
+        CHECK_EQ(stats.blocked, 1u);
+        CHECK_EQ(stats.rejected, 1u);
+    }
+
+    {
+        auto loop = makeLoop(EventLoop::Overflow::Fail);
+        auto gate = hold(*loop);
+        std::vector<int> ran;
+        for (int i = 0; i < 6; i++) {
+            loop->enqueue([&ran, i] { ran.push_back(i); });
+        }
+        auto refused = loop->enqueueAsync([] { return 1; });
+        gate->set_value();
+        CHECK_THROWS_AS(refused.get(), std::future_error);
+        settle(*loop);
+        CHECK_EQ(ran.size(), 4u);
+        CHECK_EQ(loop->stats().rejected, 3u);
+    }
+
+    {
+        auto loop = makeLoop(EventLoop::Overflow::DropOldest);
+        auto gate = hold(*loop);
+        std::vector<int> ran;
+        for (int i = 0; i < 10; i++) {
+            CHECK(loop->tryEnqueue([&ran, i] { ran.push_back(i); }));
+        }
+        CHECK_EQ(loop->stats().queueDepth, 4u);
+        gate->set_value();
+        settle(*loop);
+        CHECK_EQ(ran, (std::vector<int>{6, 7, 8, 9}));
+        CHECK_EQ(loop->stats().droppedOldest, 6u);
+    }
+
+    {
+        auto loop = makeLoop(EventLoop::Overflow::DropNewest);
+        auto gate = hold(*loop);
+        std::vector<int> ran;
+        for (int i = 0; i < 10; i++) {
+            loop->enqueue([&ran, i] { ran.push_back(i); });
+        }
+        gate->set_value();
+        settle(*loop);
+        CHECK_EQ(ran, (std::vector<int>{0, 1, 2, 3}));
+        CHECK_EQ(loop->stats().droppedNewest, 6u);
+    }
+}
+
+TEST_CASE("handycpp::event_loop threadless") {
+    EventLoop::Options options;
+    options.threadless = true;
+    EventLoop loop(options);
+
+    std::vector<int> ran;
+    CHECK_EQ(loop.poll(), 0u);
+    loop.enqueue([&] { ran.push_back(1); });
+    loop.enqueue([&] { ran.push_back(2); }, EventLoop::Priority::High);
+    CHECK(ran.empty()); // nothing runs until the owner drives the loop
+    CHECK_EQ(loop.poll(), 2u);
+    CHECK_EQ(ran, (std::vector<int>{2, 1}));
+
+    // the driving thread is the loop thread: enqueueSync runs inline and current() is set inside tasks
+    CHECK_EQ(loop.enqueueSync([] { return 5; }), 5);
+    EventLoop *seen = nullptr;
+    loop.enqueue([&] { seen = EventLoop::current(); });
+    loop.poll();
+    CHECK_EQ(seen, &loop);
+    CHECK_EQ(EventLoop::current(), nullptr);
+
+    // runOnce waits for work from other threads, or gives up after the timeout
+    auto start = std::chrono::steady_clock::now();
+    CHECK_EQ(loop.runOnce(std::chrono::milliseconds(20)), 0u);
+    CHECK_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(20));
+
+    std::thread producer([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        loop.enqueue([&] { ran.push_back(3); });
+    });
+    CHECK_EQ(loop.runOnce(std::chrono::seconds(10)), 1u);
+    producer.join();
+    CHECK_EQ(ran.back(), 3);
+
+    // a cross-thread enqueueSync is served by whoever drives the loop
+    std::thread caller([&] { CHECK_EQ(loop.enqueueSync([] { return 7; }), 7); });
+    while (loop.runOnce(std::chrono::milliseconds(1)) == 0) {
+    }
+    caller.join();
+
+    loop.enqueue([&] { ran.push_back(4); }); // destroyed unrun with the loop
+
+    // the spin/yield phase keeps to the timeout, and what it finds is run by the same call
+    EventLoop::Options spinOptions = options;
+    spinOptions.spinFor = std::chrono::milliseconds(500);
+    spinOptions.yieldFor = std::chrono::milliseconds(500);
+    EventLoop spinning(spinOptions);
+    start = std::chrono::steady_clock::now();
+    CHECK_EQ(spinning.runOnce(std::chrono::milliseconds(1)), 0u);
+    CHECK_LT(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(250));
+
+    int spun = 0;
+    std::thread late([&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        spinning.enqueue([&] { spun++; });
+    });
+    CHECK_EQ(spinning.runOnce(std::chrono::seconds(10)), 1u);
+    late.join();
+    CHECK_EQ(spun, 1);
+}
+
+struct event_loop_colliding_key {
+    int id;
+    bool operator==(const event_loop_colliding_key &other) const { return id == other.id; }
+};
+namespace std {
+template <> struct hash<event_loop_colliding_key> {
+    size_t operator()(const event_loop_colliding_key &) const noexcept { return 7; } // same as std::hash<int>(7)
+};
+} // namespace std
+
+TEST_CASE("handycpp::event_loop unique tasks") {
+    EventLoop::Options options;
+    options.threadless = true; // so the burst is guaranteed to land while the first post is pending
+    EventLoop loop(options);
+
+    int refreshes = 0;
+    int value = 0;
+    int shown = -1;
+    for (int i = 0; i < 1000; i++) {
+        value = i;
+        bool queued = loop.enqueueUnique(std::string("refresh"), [&] {
+            refreshes++;
+            shown = value;
+        });
+        CHECK_EQ(queued, i == 0);
+    }
+    loop.enqueueUnique(42, [&] { refreshes++; }); // a different key
+    CHECK_EQ(loop.poll(), 2u);
+    CHECK_EQ(refreshes, 2);
+    CHECK_EQ(shown, 999);
+
+    // once it has run, the key can be queued again
+    CHECK(loop.enqueueUnique(std::string("refresh"), [&] { refreshes++; }));
+    loop.poll();
+    CHECK_EQ(refreshes, 3);
+
+    // replace keeps the queue position but runs the latest task
+    std::vector<int> order;
+    loop.enqueue([&] { order.push_back(-1); });
+    for (int i = 0; i < 5; i++) {
+        loop.enqueueReplace(7, [&order, i] { order.push_back(i); });
+    }
+    loop.enqueue([&] { order.push_back(-2); });
+    loop.poll();
+    CHECK_EQ(order, (std::vector<int>{-1, 4, -2}));
+    CHECK_EQ(loop.stats().coalesced, 999u + 4u);
+
+    // keys are told apart by type and value, not by their hash
+    std::vector<std::string> ran;
+    CHECK(loop.enqueueUnique(7, [&] { ran.emplace_back("int"); }));
+    CHECK(loop.enqueueUnique(7ul, [&] { ran.emplace_back("unsigned long"); }));
+    CHECK(loop.enqueueUnique(event_loop_colliding_key{1}, [&] { ran.emplace_back("1"); }));
+    CHECK(loop.enqueueUnique(event_loop_colliding_key{2}, [&] { ran.emplace_back("2"); }));
+    CHECK_FALSE(loop.enqueueUnique(event_loop_colliding_key{2}, [&] { ran.emplace_back("2 again"); }));
+    loop.poll();
+    CHECK_EQ(ran, (std::vector<std::string>{"int", "unsigned long", "1", "2"}));
+
+    // keyed tasks still queued when the loop goes away are destroyed unrun, threadless or not
+    int late = 0;
+    {
+        EventLoop pending(options);
+        pending.enqueueUnique(1, [&] { late++; });
+        pending.enqueueReplace(2, [&] { late++; }, EventLoop::Priority::Background);
+    }
+    CHECK_EQ(late, 0);
+    {
+        EventLoop threaded;
+        std::promise<void> gate;
+        std::shared_future<void> opened = gate.get_future().share();
+        threaded.enqueue([opened] { opened.wait(); });
+        threaded.enqueueUnique(1, [&] { late++; }, EventLoop::Priority::Background);
+        gate.set_value();
+    }
+    CHECK_EQ(late, 1);
+}
+
+TEST_CASE("handycpp::event_loop timers") {
+    EventLoop loop;
+    std::mutex mutex;
+    std::vector<int> fired;
+    auto record = [&](int id) {
+        std::lock_guard<std::mutex> guard(mutex);
+        fired.push_back(id);
+    };
+
+    auto start = std::chrono::steady_clock::now();
+    loop.enqueueAfter(std::chrono::milliseconds(30), [&] { record(3); });
+    loop.enqueueAfter(std::chrono::milliseconds(10), [&] { record(1); });
+    loop.enqueueAfter(std::chrono::milliseconds(10), [&] { record(2); }); // same deadline, posting order
+    loop.enqueue([&] { loop.enqueueAfter(std::chrono::milliseconds(20), [&] { record(4); }); }); // from the loop
+    auto deadline = start + std::chrono::seconds(5);
+    while (loop.enqueueSync([&] { return fired.size(); }) < 4 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_GE(std::chrono::steady_clock::now() - start, std::chrono::milliseconds(30));
+    CHECK_EQ(fired, (std::vector<int>{1, 2, 4, 3}));
+
+    // a threadless loop runs due timers from runOnce, which waits no longer than the next one
+    EventLoop::Options options;
+    options.threadless = true;
+    EventLoop driven(options);
+    bool ran = false;
+    driven.enqueueAfter(std::chrono::milliseconds(10), [&] { ran = true; });
+    driven.poll(); // hands the timer over, it is not due yet
+    CHECK_FALSE(ran);
+    start = std::chrono::steady_clock::now();
+    while (!ran && std::chrono::steady_clock::now() - start < std::chrono::seconds(5)) {
+        driven.runOnce(std::chrono::seconds(10));
+    }
+    CHECK(ran);
+    CHECK_LT(std::chrono::steady_clock::now() - start, std::chrono::seconds(5));
+
+    loop.enqueueAfter(std::chrono::hours(1), [&] { record(5); }); // never fires, dropped with the loop
+}
+
+#if defined(__linux__)
+TEST_CASE("handycpp::event_loop placement") {
+    std::vector<std::string> errors;
+    EventLoop::Options options;
+    options.placement.cpus = {0};
+    options.placement.numaNode = handycpp::ThreadPlacement::cpusOfNode(0).empty() ? -1 : 0;
+    options.placement.name = "handycpp-loop-with-a-long-name";
+    options.placement.policy = SCHED_BATCH; // needs no privileges, unlike the realtime ones
+    options.placement.onError = [&](const char *what, int) { errors.emplace_back(what); };
+    {
+        EventLoop loop(options);
+        loop.enqueueSync([] {
+            char name[16];
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+            CHECK_EQ(std::string(name), "handycpp-loop-w");
+            cpu_set_t set;
+            sched_getaffinity(0, sizeof(set), &set);
+            CHECK_EQ(CPU_COUNT(&set), 1);
+            CHECK(CPU_ISSET(0, &set));
+            CHECK_EQ(sched_getscheduler(0), SCHED_BATCH);
+        });
+    }
+    options.lockFree = true; // the queue node pools are grown from the placed thread
+    {
+        EventLoop loop(options);
+        CHECK_EQ(loop.enqueueSync([] { return 1; }), 1);
+    }
+    CHECK(errors.empty());
+
+    handycpp::ThreadPlacement placement;
+    placement.name = "worker";
+    CHECK_EQ(placement.forWorker(12).name, "worker-12");
+    placement.name = "a-name-that-is-far-too-long";
+    CHECK_EQ(placement.forWorker(3).name, "a-name-that-i-3"); // the index survives truncation
+    placement.cpus = {4, 5};
+    placement.spread = true;
+    CHECK_EQ(placement.forWorker(3).cpus, (std::vector<int>{5}));
+
+    // a setting that does not take is reported and the rest still applies
+    handycpp::ThreadPlacement bad;
+    bad.cpus = {CPU_SETSIZE + 1};
+    bad.onError = [&](const char *what, int) { errors.emplace_back(what); };
+    std::thread([&] { CHECK_FALSE(bad.apply()); }).join();
+    CHECK_EQ(errors, (std::vector<std::string>{"cpu affinity"}));
+}
+#endif
+
+TEST_CASE("handycpp::event_loop cancellation") {
+    EventLoop::Options options;
+    options.threadless = true; // nothing runs until poll(), so the tokens can change while the tasks are queued
+    EventLoop loop(options);
+
+    handycpp::CancellationToken request;
+    const handycpp::CancellationToken expired = handycpp::CancellationToken::withTimeout(std::chrono::nanoseconds(0));
+    auto later = handycpp::CancellationToken::withTimeout(std::chrono::hours(1));
+    std::vector<int> ran;
+    loop.enqueue([&] { ran.push_back(1); }, request);
+    loop.enqueue([&] { ran.push_back(2); }, expired);
+    loop.enqueue([&] { ran.push_back(3); }, later, EventLoop::Priority::High);
+    auto abandoned = loop.enqueueAsync(request, [] { return 4; });
+    auto kept = loop.enqueueAsync(later, [](int x) { return x; }, 5);
+    auto timedOut = loop.enqueueAsync(expired, [] {});
+    request.cancel();
+    CHECK(request.cancelled());
+    CHECK(expired.cancelled());
+    CHECK_FALSE(later.cancelled());
+
+    CHECK_EQ(loop.poll(), 2u);
+    CHECK_EQ(ran, (std::vector<int>{3}));
+    CHECK_EQ(kept.get(), 5);
+    CHECK_THROWS_AS(abandoned.get(), handycpp::TaskCancelled);
+    CHECK_THROWS_AS(timedOut.get(), handycpp::TaskCancelled);
+    CHECK_EQ(loop.stats().cancelled, 4u);
+
+    // a task that is dropped for another reason still breaks its promise as before
+    auto dropped = std::make_unique<EventLoop>(options);
+    auto orphan = dropped->enqueueAsync(later, [] {});
+    dropped = nullptr;
+    try {
+        orphan.get();
+        CHECK(false);
+    } catch (const std::future_error &e) {
+        CHECK_EQ(e.code(), std::future_errc::broken_promise);
+    }
+}
+
+TEST_CASE("handycpp::event_loop move only task") {
+    using handycpp::MoveOnlyFunction;
+    struct Counted {
+        int *destroyed;
+        explicit Counted(int *d) : destroyed(d) {}
+        Counted(Counted &&other) noexcept : destroyed(std::exchange(other.destroyed, nullptr)) {}
+        ~Counted() {
+            if (destroyed != nullptr) {
+                (*destroyed)++;
+            }
+        }
+    };
+
+    int destroyed = 0;
+    {
+        MoveOnlyFunction<int(int)> small = [c = Counted(&destroyed)](int x) { return x + 1; };
+        MoveOnlyFunction<int(int)> moved = std::move(small);
+        CHECK_FALSE(small);
+        CHECK_EQ(moved(1), 2);
+    }
+    CHECK_EQ(destroyed, 1);
+
+    std::array<char, 256> big{};
+    big[255] = 7;
+    MoveOnlyFunction<int()> onHeap = [big, c = Counted(&destroyed)] { return (int)big[255]; };
+    MoveOnlyFunction<int()> stolen = std::move(onHeap);
+    CHECK_EQ(stolen(), 7);
+    stolen = nullptr;
+    CHECK_EQ(destroyed, 2);
+
+    auto loop = std::make_unique<EventLoop>();
+    auto ptr = std::make_unique<int>(5);
+    std::promise<int> promise;
+    std::future<int> future = promise.get_future();
+    loop->enqueue([p = std::move(promise), ptr = std::move(ptr)]() mutable { p.set_value(*ptr); });
+    CHECK_EQ(future.get(), 5);
+
+    std::string s = "hello";
+    auto result = loop->enqueueAsync([](std::string &str, std::unique_ptr<int> v) { str[0] = (char)*v; }, s,
+                                     std::make_unique<int>('j'));
+    result.get();
+    CHECK_EQ(s, "jello");
+
+    auto failed = loop->enqueueAsync([]() -> int { throw std::runtime_error("boom"); });
+    CHECK_THROWS_AS(failed.get(), std::runtime_error);
+}
 #endif
 
 #endif // HANDYCPP_EVENT_LOOP_H
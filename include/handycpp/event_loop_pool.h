@@ -0,0 +1,380 @@
+//
+// Created by zhangfuwen on 2026/10/17.
+//
+
+#ifndef HANDYCPP_EVENT_LOOP_POOL_H
+#define HANDYCPP_EVENT_LOOP_POOL_H
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "handycpp/event_loop.h"
+
+/**
+ * a pool of worker threads with the same enqueue/enqueueAsync/enqueueSync surface as EventLoop.
+ *
+ * every worker owns two deques. tasks posted from outside the pool are spread round-robin over the workers' injection
+ * queues and run oldest first, tasks posted from a worker go to that worker's local deque and run newest first, which
+ * keeps recursive work cache-hot. a worker looks at its injection queue first every kInjectedInterval tasks, so
+ * neither kind can starve the other. once it runs dry it steals the oldest task of another worker before parking, so
+ * a deep queue on one worker never leaves the others idle.
+ *
+ * workers can be pinned, named and given a scheduling policy with a handycpp::ThreadPlacement, see the second
+ * constructor.
+ *
+ * unlike EventLoop there is no ordering guarantee between tasks, use an EventLoop when order matters.
+ *
+ * @example
+ * \code{.cpp}
+ * EventLoopPool pool(4);
+ * std::vector<std::future<int>> results;
+ * for (int i = 0; i < 100; i++) {
+ *     results.push_back(pool.enqueueAsync([i] { return i * i; }));
+ * }
+ * \endcode
+ */
+class EventLoopPool {
+public:
+    using callable_t = EventLoop::callable_t;
+
+    explicit EventLoopPool(unsigned int workers = std::thread::hardware_concurrency()) : EventLoopPool(workers, {}) {}
+
+    /**
+     * every worker is placed according to placement.forWorker(its index), see handycpp::ThreadPlacement
+     */
+    EventLoopPool(unsigned int workers, handycpp::ThreadPlacement placement) : m_placement(std::move(placement)) {
+        if (workers == 0) {
+            workers = 1;
+        }
+        for (unsigned int i = 0; i < workers; i++) {
+            m_workers.emplace_back(std::make_unique<Worker>());
+        }
+        for (unsigned int i = 0; i < workers; i++) {
+            m_workers[i]->thread = std::thread(&EventLoopPool::threadFunc, this, i);
+        }
+    }
+    EventLoopPool(const EventLoopPool &) = delete;
+    EventLoopPool(EventLoopPool &&) noexcept = delete;
+    /**
+     * runs every task that is already queued, then stops and joins the workers
+     */
+    ~EventLoopPool() noexcept {
+        {
+            std::lock_guard<std::mutex> guard(m_mutex);
+            m_stopping = true;
+        }
+        m_condVar.notify_all();
+        for (auto &worker : m_workers) {
+            worker->thread.join();
+        }
+    }
+
+    EventLoopPool &operator=(const EventLoopPool &) = delete;
+    EventLoopPool &operator=(EventLoopPool &&) noexcept = delete;
+
+    void enqueue(callable_t &&callable) noexcept {
+        {
+            Worker &worker = *m_workers[targetWorker()];
+            std::lock_guard<std::mutex> guard(worker.mutex);
+            targetDeque(worker).emplace_back(std::move(callable));
+        }
+        announce(1);
+    }
+
+    /**
+     * same as EventLoop::enqueueBulk. the whole batch lands on one worker in a single critical section, the other
+     * workers are woken once and take their share by stealing.
+     */
+    template <typename Iterator> void enqueueBulk(Iterator first, Iterator last) {
+        size_t count = 0;
+        {
+            Worker &worker = *m_workers[targetWorker()];
+            std::lock_guard<std::mutex> guard(worker.mutex);
+            auto &tasks = targetDeque(worker);
+            for (; first != last; ++first, ++count) {
+                tasks.emplace_back(std::move(*first));
+            }
+        }
+        if (count > 0) {
+            announce(count);
+        }
+    }
+
+    template <typename Range> void enqueueBulk(Range &&range) { enqueueBulk(std::begin(range), std::end(range)); }
+
+    /**
+     * same as EventLoop::enqueueSync, runs inline when called from one of the pool's workers
+     */
+    template <typename Func, typename... Args> auto enqueueSync(Func &&callable, Args &&...args) {
+        if (currentWorker() != npos) {
+            return std::invoke(std::forward<Func>(callable), std::forward<Args>(args)...);
+        }
+
+        return handycpp::runSync(
+            [this](callable_t &&task) { enqueue(std::move(task)); },
+            std::forward<Func>(callable),
+            std::forward<Args>(args)...);
+    }
+
+    /**
+     * same as EventLoop::enqueueAsync
+     */
+    template <typename Func, typename... Args> [[nodiscard]] auto enqueueAsync(Func &&callable, Args &&...args) {
+        auto [task, future] = handycpp::makeAsyncTask(std::forward<Func>(callable), std::forward<Args>(args)...);
+        enqueue(std::move(task));
+        return std::move(future);
+    }
+
+    template <typename Ret, typename... Args>
+    [[nodiscard]] auto enqueueAsync(std::function<Ret(Args...)> &callable, Args &&...args) {
+        auto [task, future] = handycpp::makeAsyncTask(callable, std::forward<Args>(args)...);
+        enqueue(std::move(task));
+        return std::move(future);
+    }
+
+    size_t size() const { return m_workers.size(); }
+
+private:
+    static constexpr size_t npos = static_cast<size_t>(-1);
+    static constexpr unsigned kInjectedInterval = 61;
+
+    struct Worker {
+        std::mutex mutex;
+        std::deque<callable_t> injected; // posted from outside the pool, FIFO
+        std::deque<callable_t> tasks;    // posted by this worker, LIFO
+        unsigned ticks = 0;              // worker thread only
+        std::thread thread;
+    };
+
+    // which pool the current thread works for, a thread only ever belongs to one pool
+    static const EventLoopPool *&currentPool() {
+        static thread_local const EventLoopPool *pool = nullptr;
+        return pool;
+    }
+    static size_t &currentIndex() {
+        static thread_local size_t index = npos;
+        return index;
+    }
+    size_t currentWorker() const { return currentPool() == this ? currentIndex() : npos; }
+
+    // workers keep what they post, everybody else spreads round-robin
+    size_t targetWorker() {
+        size_t index = currentWorker();
+        if (index == npos) {
+            index = m_next.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+        }
+        return index;
+    }
+
+    // called with worker.mutex held, after targetWorker() picked worker
+    std::deque<callable_t> &targetDeque(Worker &worker) {
+        return currentWorker() == npos ? worker.injected : worker.tasks;
+    }
+
+    // publishes count new tasks and wakes parked workers, pairs with the m_idle handshake in threadFunc
+    void announce(size_t count) noexcept {
+        m_pending.fetch_add(count, std::memory_order_seq_cst);
+        if (m_idle.load(std::memory_order_seq_cst) > 0) {
+            { std::lock_guard<std::mutex> guard(m_mutex); }
+            if (count == 1) {
+                m_condVar.notify_one();
+            } else {
+                m_condVar.notify_all();
+            }
+        }
+    }
+
+    bool popOwn(size_t index, callable_t &out) {
+        Worker &worker = *m_workers[index];
+        std::lock_guard<std::mutex> guard(worker.mutex);
+        bool injectedFirst = ++worker.ticks % kInjectedInterval == 0 || worker.tasks.empty();
+        if (injectedFirst && !worker.injected.empty()) {
+            out = std::move(worker.injected.front());
+            worker.injected.pop_front();
+            return true;
+        }
+        if (!worker.tasks.empty()) {
+            out = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+            return true;
+        }
+        return false;
+    }
+
+    bool steal(size_t thief, callable_t &out) {
+        for (size_t i = 1; i < m_workers.size(); i++) {
+            Worker &victim = *m_workers[(thief + i) % m_workers.size()];
+            std::unique_lock<std::mutex> lock(victim.mutex, std::try_to_lock);
+            if (!lock.owns_lock()) {
+                continue;
+            }
+            for (auto *tasks : {&victim.injected, &victim.tasks}) {
+                if (!tasks->empty()) {
+                    out = std::move(tasks->front());
+                    tasks->pop_front();
+                    return true;
+                }
+            }
+        }
+        return false;
+    }
+
+    void threadFunc(size_t index) noexcept {
+        currentPool() = this;
+        currentIndex() = index;
+        if (!m_placement.empty()) {
+            m_placement.forWorker(index).apply();
+        }
+
+        callable_t func;
+        while (true) {
+            if (popOwn(index, func) || steal(index, func)) {
+                m_pending.fetch_sub(1, std::memory_order_relaxed);
+                func();
+                func = nullptr;
+                continue;
+            }
+            if (m_pending.load(std::memory_order_seq_cst) > 0) {
+                // a victim was locked during the steal attempt, or a push is in flight
+                std::this_thread::yield();
+                continue;
+            }
+
+            std::unique_lock<std::mutex> lock(m_mutex);
+            if (m_stopping) {
+                break;
+            }
+            m_idle.fetch_add(1, std::memory_order_seq_cst);
+            m_condVar.wait(lock, [this] { return m_stopping || m_pending.load(std::memory_order_seq_cst) > 0; });
+            m_idle.fetch_sub(1, std::memory_order_relaxed);
+        }
+    }
+
+    handycpp::ThreadPlacement m_placement;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::atomic<size_t> m_next{0};
+    // number of queued but not yet started tasks, pairs with m_idle to avoid lost wakeups
+    std::atomic<size_t> m_pending{0};
+    std::atomic<int> m_idle{0};
+    std::mutex m_mutex{};
+    std::condition_variable m_condVar{};
+    bool m_stopping{false};
+};
+
+#ifdef HANDYCPP_TEST
+#include "doctest/doctest.h"
+
+TEST_CASE("handycpp::event_loop_pool") {
+    auto pool = std::make_unique<EventLoopPool>(4);
+
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 1000; i++) {
+        results.push_back(pool->enqueueAsync([i] { return i * 2; }));
+    }
+    int sum = 0;
+    for (auto &result : results) {
+        sum += result.get();
+    }
+    CHECK_EQ(sum, 999 * 1000);
+
+    std::function<int(int, int)> f = [](int x, int y) { return x + y; };
+    CHECK_EQ(pool->enqueueAsync(f, 1, 2).get(), 3);
+    CHECK_EQ(pool->enqueueSync([](int x) { return x + 1; }, 41), 42);
+
+    // nested posts from a worker, and enqueueSync from a worker must not deadlock
+    std::atomic<int> nested{0};
+    pool->enqueueSync([&] {
+        for (int i = 0; i < 100; i++) {
+            pool->enqueue([&] { nested++; });
+        }
+        pool->enqueueSync([&] { nested++; });
+    });
+
+    // all queued on one worker's deque, so the other workers have to steal to make progress together
+    std::atomic<int> arrived{0};
+    const int workers = (int)pool->size();
+    pool->enqueueSync([&] {
+        for (int i = 0; i < workers; i++) {
+            pool->enqueue([&] {
+                arrived++;
+                auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+                while (arrived.load() < workers && std::chrono::steady_clock::now() < deadline) {
+                    std::this_thread::yield();
+                }
+            });
+        }
+    });
+
+    std::atomic<int> bulk{0};
+    std::vector<EventLoopPool::callable_t> tasks;
+    for (int i = 0; i < 1000; i++) {
+        tasks.emplace_back([&bulk] { bulk++; });
+    }
+    pool->enqueueBulk(tasks);
+
+    pool = nullptr;
+    CHECK_EQ(bulk.load(), 1000);
+    CHECK_EQ(nested.load(), 101);
+    CHECK_EQ(arrived.load(), 4);
+
+    // submissions from outside run oldest first, and are not starved by a worker that keeps posting to itself
+    std::vector<int> order;
+    std::atomic<int> chain{0};
+    std::function<void(int)> respawn;
+    EventLoopPool single(1);
+    respawn = [&](int left) {
+        chain = left;
+        if (left > 0) {
+            single.enqueue([&respawn, left] { respawn(left - 1); });
+        }
+    };
+    std::promise<void> gate;
+    std::shared_future<void> opened = gate.get_future().share();
+    single.enqueue([opened] { opened.wait(); });
+    single.enqueue([&] { respawn(1000); });
+    for (int i = 0; i < 5; i++) {
+        single.enqueue([&order, i] { order.push_back(i); });
+    }
+    gate.set_value();
+    CHECK_GT(single.enqueueSync([&] { return chain.load(); }), 0);
+    CHECK_EQ(order, (std::vector<int>{0, 1, 2, 3, 4}));
+}
+#if defined(__linux__)
+TEST_CASE("handycpp::event_loop_pool placement") {
+    // every worker gets a numbered name, spread pins each to one cpu of the set
+    handycpp::ThreadPlacement placement;
+    placement.name = "worker";
+    placement.cpus = {0};
+    placement.spread = true;
+    EventLoopPool pool(2, placement);
+    std::mutex mutex;
+    std::vector<std::string> names;
+    std::vector<std::future<void>> results;
+    for (int i = 0; i < 2; i++) {
+        results.push_back(pool.enqueueAsync([&] {
+            char name[16];
+            pthread_getname_np(pthread_self(), name, sizeof(name));
+            cpu_set_t set;
+            sched_getaffinity(0, sizeof(set), &set);
+            CHECK_EQ(CPU_COUNT(&set), 1);
+            std::lock_guard<std::mutex> guard(mutex);
+            names.emplace_back(name);
+        }));
+    }
+    for (auto &result : results) {
+        result.get();
+    }
+    for (auto &name : names) {
+        CHECK((name == "worker-0" || name == "worker-1"));
+    }
+}
+#endif
+#endif
+
+#endif // HANDYCPP_EVENT_LOOP_POOL_H
@@ -0,0 +1,738 @@
+//
+// Created by zhangfuwen on 2026/10/17.
+//
+
+#ifndef HANDYCPP_FUTURE_H
+#define HANDYCPP_FUTURE_H
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <future>
+#include <memory>
+#include <new>
+#include <optional>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "handycpp/event_loop.h"
+
+/**
+ * futures that can be chained instead of waited on.
+ *
+ * Future<T>::then(executor, func) runs func(value) on an EventLoop or EventLoopPool once the value is there, and
+ * returns the future of its result, no thread blocks in between. when_all() and when_any() combine futures the same
+ * way. an exception skips every then() down the chain and comes out of get() at the end. func may return a Future
+ * itself, the result is then the inner future's value.
+ *
+ * the shared state is one small block recycled through a per-thread free list, and completion is a single
+ * compare-and-swap, no mutex. a Future has one consumer: get() and then() consume it, like std::future::get().
+ *
+ * @example
+ * \code{.cpp}
+ * std::vector<handycpp::Future<Reply>> calls;
+ * for (auto &backend : backends) {
+ *     calls.push_back(handycpp::enqueueFuture(backend.loop, [&backend, q] { return backend.query(q); }));
+ * }
+ * handycpp::when_all(std::move(calls)).then(requestLoop, [session](std::vector<Reply> replies) {
+ *     session->respond(merge(replies));
+ * });
+ * \endcode
+ */
+namespace handycpp {
+
+template <typename T> class Future;
+template <typename T> class Promise;
+
+namespace detail {
+
+// per-thread free list of equally sized blocks. a block freed on another thread joins that thread's list
+template <size_t Size, size_t Align> class BlockPool {
+public:
+    static void *allocate() {
+        auto &blocks = cache().blocks;
+        if (!blocks.empty()) {
+            void *block = blocks.back();
+            blocks.pop_back();
+            return block;
+        }
+        return ::operator new(Size, std::align_val_t(Align));
+    }
+
+    static void release(void *block) noexcept {
+        auto &blocks = cache().blocks;
+        if (blocks.size() < kMaxCached) {
+            blocks.push_back(block); // never reallocates, see Cache()
+            return;
+        }
+        ::operator delete(block, std::align_val_t(Align));
+    }
+
+private:
+    static constexpr size_t kMaxCached = 256;
+
+    struct Cache {
+        Cache() { blocks.reserve(kMaxCached); }
+        ~Cache() {
+            for (void *block : blocks) {
+                ::operator delete(block, std::align_val_t(Align));
+            }
+        }
+        std::vector<void *> blocks;
+    };
+
+    static Cache &cache() {
+        static thread_local Cache cache;
+        return cache;
+    }
+};
+
+template <typename T> class FutureState {
+public:
+    using value_type = std::conditional_t<std::is_void_v<T>, bool, T>;
+    // FutureState is incomplete here, so its size and alignment are checked in create(). an over-aligned value
+    // pads the members around it by up to its alignment on either side
+    static constexpr size_t kAlign = std::max(alignof(std::max_align_t), alignof(value_type));
+    static constexpr size_t kSize = sizeof(value_type) + 128 + (kAlign > alignof(std::max_align_t) ? 2 * kAlign : 0);
+    using pool_type = BlockPool<kSize, kAlign>;
+
+    static FutureState *create() {
+        static_assert(sizeof(FutureState) <= kSize, "FutureState outgrew its pool block");
+        static_assert(alignof(FutureState) <= kAlign, "FutureState is aligned stricter than its pool block");
+        return new (pool_type::allocate()) FutureState();
+    }
+
+    void addRef() noexcept { m_refs.fetch_add(1, std::memory_order_relaxed); }
+    void release() noexcept {
+        if (m_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            this->~FutureState();
+            pool_type::release(this);
+        }
+    }
+
+    template <typename... Args> void setValue(Args &&...args) {
+        m_value.emplace(std::forward<Args>(args)...);
+        publish();
+    }
+    void setException(std::exception_ptr exception) noexcept {
+        m_exception = std::move(exception);
+        publish();
+    }
+
+    bool ready() const noexcept { return m_state.load(std::memory_order_acquire) != kEmpty; }
+
+    // runs continuation right away when the result is already there, otherwise on the thread that provides it
+    void onReady(MoveOnlyFunction<void()> &&continuation) noexcept {
+        m_continuation = std::move(continuation);
+        uint8_t expected = kEmpty;
+        if (!m_state.compare_exchange_strong(expected, kWaiting, std::memory_order_acq_rel)) {
+            fire();
+        }
+    }
+
+    // moves the result out, or rethrows the exception. only valid once ready()
+    value_type take() {
+        if (m_exception) {
+            std::rethrow_exception(m_exception);
+        }
+        return std::move(*m_value);
+    }
+    std::exception_ptr exception() const noexcept { return m_exception; }
+
+private:
+    static constexpr uint8_t kEmpty = 0;   // neither result nor continuation yet
+    static constexpr uint8_t kReady = 1;   // result first
+    static constexpr uint8_t kWaiting = 2; // continuation first
+
+    FutureState() = default;
+    ~FutureState() = default;
+
+    void publish() noexcept {
+        uint8_t expected = kEmpty;
+        if (!m_state.compare_exchange_strong(expected, kReady, std::memory_order_acq_rel)) {
+            fire(); // whoever comes second runs the continuation
+        }
+    }
+
+    void fire() noexcept {
+        auto continuation = std::move(m_continuation);
+        m_state.store(kReady, std::memory_order_release);
+        continuation();
+    }
+
+    std::atomic<uint32_t> m_refs{1};
+    std::atomic<uint8_t> m_state{kEmpty};
+    std::optional<value_type> m_value;
+    std::exception_ptr m_exception;
+    MoveOnlyFunction<void()> m_continuation;
+};
+
+template <typename T> struct is_future : std::false_type {};
+template <typename T> struct is_future<Future<T>> : std::true_type {};
+
+template <typename Func, typename T> struct continuation_result {
+    using type = std::invoke_result_t<Func, T &&>;
+};
+template <typename Func> struct continuation_result<Func, void> {
+    using type = std::invoke_result_t<Func>;
+};
+
+template <typename R> struct unwrap_future {
+    using type = R;
+};
+template <typename R> struct unwrap_future<Future<R>> {
+    using type = R;
+};
+
+} // namespace detail
+
+template <typename T> class Promise {
+public:
+    Promise() : m_state(detail::FutureState<T>::create()) {}
+    Promise(Promise &&other) noexcept : m_state(std::exchange(other.m_state, nullptr)) {}
+    Promise(const Promise &) = delete;
+    Promise &operator=(Promise &&other) noexcept {
+        if (this != &other) {
+            abandon();
+            m_state = std::exchange(other.m_state, nullptr);
+        }
+        return *this;
+    }
+    Promise &operator=(const Promise &) = delete;
+    /**
+     * a promise destroyed before it was fulfilled breaks its future with std::future_errc::broken_promise
+     */
+    ~Promise() { abandon(); }
+
+    /**
+     * may be called once
+     */
+    Future<T> get_future() {
+        m_state->addRef();
+        return Future<T>(m_state);
+    }
+
+    template <typename... Args> void set_value(Args &&...args) {
+        auto *state = std::exchange(m_state, nullptr);
+        try {
+            state->setValue(std::forward<Args>(args)...);
+        } catch (...) {
+            state->setException(std::current_exception()); // constructing the value threw
+        }
+        state->release();
+    }
+    void set_exception(std::exception_ptr exception) noexcept {
+        auto *state = m_state;
+        m_state = nullptr;
+        state->setException(std::move(exception));
+        state->release();
+    }
+
+private:
+    void abandon() noexcept {
+        if (m_state != nullptr) {
+            set_exception(std::make_exception_ptr(std::future_error(std::future_errc::broken_promise)));
+        }
+    }
+
+    detail::FutureState<T> *m_state;
+};
+
+template <typename T> class Future {
+public:
+    using value_type = T;
+
+    Future() = default;
+    Future(Future &&other) noexcept : m_state(std::exchange(other.m_state, nullptr)) {}
+    Future(const Future &) = delete;
+    Future &operator=(Future &&other) noexcept {
+        if (this != &other) {
+            reset();
+            m_state = std::exchange(other.m_state, nullptr);
+        }
+        return *this;
+    }
+    Future &operator=(const Future &) = delete;
+    ~Future() { reset(); }
+
+    bool valid() const noexcept { return m_state != nullptr; }
+    bool ready() const noexcept { return m_state != nullptr && m_state->ready(); }
+
+    /**
+     * blocks until the value is there and returns it, or rethrows the exception. consumes the future.
+     */
+    T get() {
+        if (!m_state->ready()) {
+            OneShotLatch latch;
+            m_state->onReady([&latch] { latch.countDown(); });
+            latch.wait();
+        }
+        auto *state = std::exchange(m_state, nullptr);
+        struct Release {
+            detail::FutureState<T> *state;
+            ~Release() { state->release(); }
+        } release{state};
+        if constexpr (std::is_void_v<T>) {
+            state->take();
+        } else {
+            return state->take();
+        }
+    }
+
+    /**
+     * runs func(value), or func() for Future<void>, on executor once the value is there and returns the future of
+     * its result. when this future holds an exception func is skipped and the exception is passed on.
+     * consumes the future.
+     */
+    template <typename Executor, typename Func> auto then(Executor &executor, Func &&func) {
+        return chain(&executor, std::forward<Func>(func));
+    }
+
+    /**
+     * same, but func runs inline on whichever thread completes this future, or right away when it is ready
+     */
+    template <typename Func> auto then(Func &&func) { return chain<EventLoop>(nullptr, std::forward<Func>(func)); }
+
+private:
+    template <typename> friend class Promise;
+    template <typename> friend class Future;
+    template <typename U> friend Future<std::vector<U>> when_all_values(std::vector<Future<U>> &&);
+    template <typename U> friend void forward_to(Future<U> &&, Promise<U> &&);
+    template <typename U> friend class WhenAny;
+
+    explicit Future(detail::FutureState<T> *state) : m_state(state) {}
+
+    void reset() noexcept {
+        if (m_state != nullptr) {
+            std::exchange(m_state, nullptr)->release();
+        }
+    }
+
+    // hands the state to continuation, which owns the reference from then on
+    void consume(MoveOnlyFunction<void(detail::FutureState<T> *)> &&continuation) {
+        auto *state = std::exchange(m_state, nullptr);
+        state->onReady([state, continuation = std::move(continuation)]() mutable { continuation(state); });
+    }
+
+    template <typename Executor, typename Func> auto chain(Executor *executor, Func &&func) {
+        using raw_result = typename detail::continuation_result<std::decay_t<Func>, T>::type;
+        using result_type = typename detail::unwrap_future<raw_result>::type;
+
+        Promise<result_type> promise;
+        auto future = promise.get_future();
+        consume([executor, promise = std::move(promise), func = std::decay_t<Func>(std::forward<Func>(func))](
+                    detail::FutureState<T> *state) mutable {
+            // upstream owns the state reference, so a task the executor destroys unrun still releases it
+            auto run = [upstream = Future(state), promise = std::move(promise), func = std::move(func)]() mutable {
+                auto *state = upstream.m_state;
+                try {
+                    if constexpr (detail::is_future<raw_result>::value) {
+                        forward_to(invokeWith(func, state), std::move(promise));
+                    } else if constexpr (std::is_void_v<raw_result>) {
+                        invokeWith(func, state);
+                        promise.set_value();
+                    } else {
+                        promise.set_value(invokeWith(func, state));
+                    }
+                } catch (...) {
+                    promise.set_exception(std::current_exception());
+                }
+            };
+            if (executor != nullptr) {
+                executor->enqueue(std::move(run));
+            } else {
+                run();
+            }
+        });
+        return future;
+    }
+
+    template <typename Func> static decltype(auto) invokeWith(Func &func, detail::FutureState<T> *state) {
+        if constexpr (std::is_void_v<T>) {
+            state->take();
+            return func();
+        } else {
+            return func(state->take());
+        }
+    }
+
+    detail::FutureState<T> *m_state = nullptr;
+};
+
+/**
+ * fulfils promise with whatever future ends up holding
+ */
+template <typename T> void forward_to(Future<T> &&future, Promise<T> &&promise) {
+    future.consume([promise = std::move(promise)](detail::FutureState<T> *state) mutable {
+        if (auto exception = state->exception()) {
+            promise.set_exception(exception);
+        } else if constexpr (std::is_void_v<T>) {
+            promise.set_value();
+        } else {
+            promise.set_value(state->take());
+        }
+        state->release();
+    });
+}
+
+template <typename T> Future<std::decay_t<T>> makeReadyFuture(T &&value) {
+    Promise<std::decay_t<T>> promise;
+    auto future = promise.get_future();
+    promise.set_value(std::forward<T>(value));
+    return future;
+}
+
+inline Future<void> makeReadyFuture() {
+    Promise<void> promise;
+    auto future = promise.get_future();
+    promise.set_value();
+    return future;
+}
+
+// the handycpp::Promise overload of fulfil() from event_loop.h
+template <typename Return, typename Func, typename Bound>
+void fulfil(Promise<Return> &promise, Func &func, Bound &bound) noexcept {
+    try {
+        if constexpr (std::is_void_v<Return>) {
+            std::apply([&](auto &...a) { std::invoke(func, unwrap_bound_arg(a)...); }, bound);
+            promise.set_value();
+        } else {
+            promise.set_value(std::apply([&](auto &...a) { return std::invoke(func, unwrap_bound_arg(a)...); }, bound));
+        }
+    } catch (...) {
+        promise.set_exception(std::current_exception());
+    }
+}
+
+/**
+ * the Future flavour of EventLoop::enqueueAsync: runs callable(args...) on executor and returns a Future of the
+ * result. arguments are bound the same way as for enqueueAsync.
+ */
+template <typename Executor, typename Func, typename... Args>
+auto enqueueFuture(Executor &executor, Func &&callable, Args &&...args) {
+    using return_type = std::invoke_result_t<Func, Args...>;
+
+    Promise<return_type> promise;
+    auto future = promise.get_future();
+    executor.enqueue(
+        [promise = std::move(promise),
+         func = std::decay_t<Func>(std::forward<Func>(callable)),
+         bound = std::tuple<bound_arg_t<Args>...>(std::forward<Args>(args)...)]() mutable {
+            fulfil(promise, func, bound);
+        });
+    return future;
+}
+
+/**
+ * enqueueFuture that the loop skips if token is cancelled or expired before the task starts, the future then fails
+ * with TaskCancelled. see EventLoop::enqueueAsync(CancellationToken, ...).
+ */
+template <typename Func, typename... Args>
+auto enqueueFuture(EventLoop &loop, CancellationToken token, Func &&callable, Args &&...args) {
+    using return_type = std::invoke_result_t<Func, Args...>;
+    using func_type = std::decay_t<Func>;
+    using bound_type = std::tuple<bound_arg_t<Args>...>;
+
+    struct Task {
+        Promise<return_type> promise;
+        CancellationToken token;
+        func_type func;
+        bound_type bound;
+        bool pending = true;
+
+        Task(Promise<return_type> &&promise, const CancellationToken &token, func_type &&func, bound_type &&bound)
+            : promise(std::move(promise)), token(token), func(std::move(func)), bound(std::move(bound)) {}
+        Task(Task &&other) noexcept
+            : promise(std::move(other.promise)),
+              token(other.token),
+              func(std::move(other.func)),
+              bound(std::move(other.bound)),
+              pending(std::exchange(other.pending, false)) {}
+        ~Task() {
+            if (pending && token.cancelled()) {
+                promise.set_exception(std::make_exception_ptr(TaskCancelled()));
+            }
+        }
+        void operator()() {
+            pending = false;
+            fulfil(promise, func, bound);
+        }
+    };
+
+    Promise<return_type> promise;
+    auto future = promise.get_future();
+    loop.enqueue(
+        Task(std::move(promise), token, func_type(std::forward<Func>(callable)), bound_type(std::forward<Args>(args)...)),
+        token);
+    return future;
+}
+
+template <typename T> Future<std::vector<T>> when_all_values(std::vector<Future<T>> &&futures) {
+    struct Context {
+        explicit Context(size_t count) : values(count), remaining(count) {}
+        std::vector<std::optional<T>> values;
+        std::atomic<size_t> remaining;
+        std::atomic<bool> failed{false};
+        std::exception_ptr exception;
+        Promise<std::vector<T>> promise;
+    };
+    auto context = std::make_shared<Context>(futures.size());
+    auto result = context->promise.get_future();
+    if (futures.empty()) {
+        context->promise.set_value();
+        return result;
+    }
+    for (size_t i = 0; i < futures.size(); i++) {
+        futures[i].consume([context, i](detail::FutureState<T> *state) {
+            if (auto exception = state->exception()) {
+                if (!context->failed.exchange(true, std::memory_order_relaxed)) {
+                    context->exception = exception; // published by the acq_rel decrement below
+                }
+            } else {
+                context->values[i].emplace(state->take());
+            }
+            state->release();
+            if (context->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                return;
+            }
+            if (context->exception) {
+                context->promise.set_exception(context->exception);
+                return;
+            }
+            std::vector<T> values;
+            values.reserve(context->values.size());
+            for (auto &value : context->values) {
+                values.push_back(std::move(*value));
+            }
+            context->promise.set_value(std::move(values));
+        });
+    }
+    return result;
+}
+
+/**
+ * ready once every future is. holds all the values in order, or the first exception any of them held.
+ */
+template <typename T> auto when_all(std::vector<Future<T>> futures) {
+    if constexpr (std::is_void_v<T>) {
+        std::vector<Future<bool>> flags;
+        flags.reserve(futures.size());
+        for (auto &future : futures) {
+            flags.push_back(future.then([] { return true; }));
+        }
+        return when_all_values(std::move(flags)).then([](std::vector<bool>) {});
+    } else {
+        return when_all_values(std::move(futures));
+    }
+}
+
+/**
+ * the same for a fixed set of futures of different types, the values come back as a tuple
+ */
+template <typename... Ts> Future<std::tuple<Ts...>> when_all(Future<Ts>... futures) {
+    static_assert(sizeof...(Ts) > 0, "when_all needs at least one future");
+    static_assert((!std::is_void_v<Ts> && ...), "use the vector overload for Future<void>");
+    auto context = std::make_shared<std::tuple<std::optional<Ts>...>>();
+    std::vector<Future<bool>> done;
+    done.reserve(sizeof...(Ts));
+    auto store = [&](auto &future, auto &slot) {
+        done.push_back(future.then([context, &slot](auto value) {
+            slot.emplace(std::move(value));
+            return true;
+        }));
+    };
+    std::apply([&](auto &...slots) { (store(futures, slots), ...); }, *context);
+    return when_all_values(std::move(done)).then([context](std::vector<bool>) {
+        return std::apply([](auto &...slots) { return std::tuple<Ts...>(std::move(*slots)...); }, *context);
+    });
+}
+
+template <typename T> class WhenAny {
+public:
+    using result_type = std::conditional_t<std::is_void_v<T>, size_t, std::pair<size_t, T>>;
+
+    /**
+     * ready as soon as the first future is, with that future's index and value, or its exception.
+     * an empty vector gives a future holding std::invalid_argument.
+     */
+    static Future<result_type> run(std::vector<Future<T>> &&futures) {
+        struct Context {
+            std::atomic<bool> decided{false};
+            Promise<result_type> promise;
+        };
+        auto context = std::make_shared<Context>();
+        auto result = context->promise.get_future();
+        if (futures.empty()) {
+            context->promise.set_exception(std::make_exception_ptr(std::invalid_argument("when_any of nothing")));
+            return result;
+        }
+        for (size_t i = 0; i < futures.size(); i++) {
+            futures[i].consume([context, i](detail::FutureState<T> *state) {
+                if (!context->decided.exchange(true, std::memory_order_acq_rel)) {
+                    if (auto exception = state->exception()) {
+                        context->promise.set_exception(exception);
+                    } else if constexpr (std::is_void_v<T>) {
+                        context->promise.set_value(i);
+                    } else {
+                        context->promise.set_value(i, state->take());
+                    }
+                }
+                state->release();
+            });
+        }
+        return result;
+    }
+};
+
+template <typename T> auto when_any(std::vector<Future<T>> futures) { return WhenAny<T>::run(std::move(futures)); }
+
+} // namespace handycpp
+
+#ifdef HANDYCPP_TEST
+#include <string>
+#include "doctest/doctest.h"
+
+TEST_CASE("handycpp::future") {
+    auto requestLoop = std::make_unique<EventLoop>();
+    std::vector<std::unique_ptr<EventLoop>> backends;
+    for (int i = 0; i < 8; i++) {
+        backends.push_back(std::make_unique<EventLoop>());
+    }
+
+    // fan out, join without blocking a thread, continue on the request loop
+    std::vector<handycpp::Future<int>> calls;
+    for (int i = 0; i < 32; i++) {
+        calls.push_back(handycpp::enqueueFuture(*backends[(size_t)i % backends.size()], [i] { return i; }));
+    }
+    std::thread::id ranOn;
+    auto total = handycpp::when_all(std::move(calls)).then(*requestLoop, [&](std::vector<int> values) {
+        ranOn = std::this_thread::get_id();
+        int sum = 0;
+        for (int v : values) {
+            sum += v;
+        }
+        return sum;
+    });
+    CHECK_EQ(total.get(), 31 * 32 / 2);
+    CHECK_EQ(ranOn, requestLoop->enqueueSync([] { return std::this_thread::get_id(); }));
+
+    // chains, flattening and exceptions
+    auto chained = handycpp::enqueueFuture(*backends[0], [] { return std::string("a"); })
+                       .then(*backends[1], [](std::string s) { return s + "b"; })
+                       .then(*backends[2], [&](std::string s) {
+                           return handycpp::enqueueFuture(*backends[3], [s] { return s + "c"; });
+                       })
+                       .then([](std::string s) { return s.size(); });
+    CHECK_EQ(chained.get(), 3u);
+
+    int skipped = 0;
+    auto failed = handycpp::enqueueFuture(*backends[0], []() -> int { throw std::runtime_error("boom"); })
+                      .then(*backends[1], [&](int v) {
+                          skipped++;
+                          return v;
+                      });
+    CHECK_THROWS_AS(failed.get(), std::runtime_error);
+    CHECK_EQ(skipped, 0);
+
+    std::vector<handycpp::Future<void>> flushes;
+    std::atomic<int> flushed{0};
+    for (auto &backend : backends) {
+        flushes.push_back(handycpp::enqueueFuture(*backend, [&] { flushed++; }));
+    }
+    handycpp::when_all(std::move(flushes)).get();
+    CHECK_EQ(flushed.load(), 8);
+
+    auto pair = handycpp::when_all(
+        handycpp::makeReadyFuture(1), handycpp::enqueueFuture(*backends[4], [] { return std::string("x"); }));
+    CHECK(pair.get() == std::make_tuple(1, std::string("x")));
+
+    // the first one wins, the slow one is ignored
+    std::promise<void> release;
+    auto slow = handycpp::enqueueFuture(*backends[5], [gate = release.get_future().share()] {
+        gate.wait();
+        return 1;
+    });
+    std::vector<handycpp::Future<int>> racers;
+    racers.push_back(std::move(slow));
+    racers.push_back(handycpp::enqueueFuture(*backends[6], [] { return 2; }));
+    auto first = handycpp::when_any(std::move(racers)).get();
+    CHECK_EQ(first.first, 1u);
+    CHECK_EQ(first.second, 2);
+    release.set_value();
+
+    {
+        handycpp::Future<int> broken;
+        {
+            handycpp::Promise<int> promise;
+            broken = promise.get_future();
+        }
+        CHECK_THROWS_AS(broken.get(), std::future_error);
+    }
+
+    requestLoop = nullptr; // the continuations above post into it
+}
+
+TEST_CASE("handycpp::future cancellation") {
+    EventLoop::Options options;
+    options.threadless = true;
+    EventLoop loop(options);
+    handycpp::CancellationToken token;
+    auto skipped = handycpp::enqueueFuture(loop, token, [] { return 1; });
+    auto kept = handycpp::enqueueFuture(loop, handycpp::CancellationToken(), [](int x) { return x; }, 2);
+    token.cancel();
+    CHECK_EQ(loop.poll(), 1u);
+    CHECK_EQ(kept.get(), 2);
+    CHECK_THROWS_AS(skipped.get(), handycpp::TaskCancelled);
+}
+
+namespace {
+struct future_tracked {
+    static inline int alive = 0;
+    future_tracked() { alive++; }
+    future_tracked(const future_tracked &) { alive++; }
+    ~future_tracked() { alive--; }
+};
+struct alignas(64) future_wide {
+    int v = 0;
+};
+} // namespace
+
+TEST_CASE("handycpp::future continuation dropped unrun") {
+    EventLoop::Options options;
+    options.threadless = true;
+    options.capacity = 1;
+    options.overflow = EventLoop::Overflow::DropNewest;
+    {
+        EventLoop loop(options);
+        loop.enqueue([] {}); // full, the continuation task is dropped
+        handycpp::Promise<future_tracked> promise;
+        auto dropped = promise.get_future().then(loop, [](future_tracked) { return 1; });
+        promise.set_value();
+        CHECK_THROWS_AS(dropped.get(), std::future_error);
+        CHECK_EQ(future_tracked::alive, 0); // the upstream state went with the task
+
+        // still pending when the loop goes away
+        handycpp::Promise<future_tracked> later;
+        auto orphaned = later.get_future().then(loop, [](future_tracked) { return 1; });
+        loop.poll();
+        later.set_value();
+        CHECK_EQ(loop.stats().queueDepth, 1u);
+        (void)orphaned;
+    }
+    CHECK_EQ(future_tracked::alive, 0);
+
+    EventLoop loop;
+    auto wide = handycpp::enqueueFuture(loop, [] {
+        future_wide w;
+        w.v = 7;
+        return w;
+    });
+    CHECK_EQ(wide.then(loop, [](const future_wide &w) { return w.v; }).get(), 7);
+}
+#endif
+
+#endif // HANDYCPP_FUTURE_H
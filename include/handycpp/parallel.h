@@ -0,0 +1,319 @@
+//
+// Created by zhangfuwen on 2026/10/17.
+//
+
+#ifndef HANDYCPP_PARALLEL_H
+#define HANDYCPP_PARALLEL_H
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "handycpp/event_loop_pool.h"
+
+/**
+ * data-parallel helpers on top of EventLoopPool.
+ *
+ * the index range is split adaptively: every participant claims the next chunk from a shared cursor, and a chunk is
+ * remaining / (2 * participants) indices but never smaller than grain. early chunks are big, which keeps the cursor
+ * cold, and the tail is cut fine, so a participant that lands on slow items does not hold everybody up at the end.
+ *
+ * the calling thread takes part and the call returns once every index has been processed. calling from one of the
+ * pool's own workers is fine, nested calls never wait for a worker that is not already running their chunks.
+ * the first exception thrown by the body stops the remaining chunks from being claimed and is rethrown to the caller.
+ *
+ * the overloads without a pool use defaultPool(), one worker per hardware thread, shared by the whole process.
+ *
+ * @example
+ * \code{.cpp}
+ * handycpp::parallel_for(size_t(0), images.size(), [&](size_t i) { convert(images[i]); });
+ *
+ * auto total = handycpp::parallel_reduce(lines, size_t(0),
+ *     [](const std::string &line) { return line.size(); },
+ *     [](size_t a, size_t b) { return a + b; });
+ *
+ * handycpp::parallel_transform(names.begin(), names.end(), upper.begin(), toUpper);
+ * \endcode
+ */
+namespace handycpp {
+
+inline EventLoopPool &defaultPool() {
+    static EventLoopPool pool;
+    return pool;
+}
+
+namespace detail {
+
+// the part of a parallel call that outlives the caller's frame: helpers that start after the work is done only
+// touch this, never the body
+struct ParallelState {
+    ParallelState(size_t first, size_t last, size_t grain, size_t participants)
+        : next(first), last(last), grain(std::max<size_t>(grain, 1)), participants(participants), remaining(last - first) {}
+
+    // claims [begin, end), false once the range is exhausted or a body threw
+    bool claim(size_t &begin, size_t &end) noexcept {
+        size_t current = next.load(std::memory_order_relaxed);
+        while (current < last) {
+            size_t size = std::max(grain, (last - current) / (2 * participants));
+            size_t stop = current + std::min(size, last - current);
+            if (next.compare_exchange_weak(current, stop, std::memory_order_relaxed)) {
+                begin = current;
+                end = stop;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // runs chunks until none are left. body is only dereferenced while a claimed chunk is unfinished, and the caller
+    // does not return before every chunk is finished
+    void work(void (*run)(void *, size_t, size_t), void *body) noexcept {
+        size_t begin;
+        size_t end;
+        while (claim(begin, end)) {
+            size_t count = end - begin;
+            try {
+                run(body, begin, end);
+            } catch (...) {
+                {
+                    std::lock_guard<std::mutex> guard(mutex);
+                    if (!exception) {
+                        exception = std::current_exception();
+                    }
+                }
+                // whatever was not claimed yet never will be, account for it here
+                size_t unclaimed = next.exchange(last, std::memory_order_relaxed);
+                count += last - std::min(unclaimed, last);
+            }
+            finish(count);
+        }
+    }
+
+    void finish(size_t count) noexcept {
+        if (remaining.fetch_sub(count, std::memory_order_acq_rel) == count) {
+            done.countDown();
+        }
+    }
+
+    std::atomic<size_t> next;
+    const size_t last;
+    const size_t grain;
+    const size_t participants;
+    std::atomic<size_t> remaining;
+    OneShotLatch done;
+    std::mutex mutex;
+    std::exception_ptr exception;
+};
+
+template <typename Body> void parallel_chunks(EventLoopPool &pool, size_t first, size_t last, size_t grain, Body &body) {
+    if (first >= last) {
+        return;
+    }
+    auto run = [](void *b, size_t begin, size_t end) { (*static_cast<Body *>(b))(begin, end); };
+    size_t helpers = pool.size();
+    auto state = std::make_shared<ParallelState>(first, last, grain, helpers + 1);
+
+    std::vector<EventLoopPool::callable_t> tasks;
+    tasks.reserve(helpers);
+    for (size_t i = 0; i < helpers; i++) {
+        tasks.emplace_back([state, run, b = (void *)&body] { state->work(run, b); });
+    }
+    pool.enqueueBulk(tasks);
+
+    state->work(run, &body);
+    state->done.wait();
+    if (state->exception) {
+        std::rethrow_exception(state->exception);
+    }
+}
+
+} // namespace detail
+
+/**
+ * calls func(i) for every i in [first, last)
+ */
+template <typename Index, typename Func>
+void parallel_for(EventLoopPool &pool, Index first, Index last, Func &&func, size_t grain = 1) {
+    static_assert(std::is_integral_v<Index>, "parallel_for over an index range needs an integral index");
+    if (first >= last) {
+        return;
+    }
+    auto body = [&](size_t begin, size_t end) {
+        for (size_t i = begin; i < end; i++) {
+            func((Index)(first + (Index)i));
+        }
+    };
+    detail::parallel_chunks(pool, 0, (size_t)(last - first), grain, body);
+}
+
+template <typename Index, typename Func, typename = std::enable_if_t<std::is_integral_v<Index>>>
+void parallel_for(Index first, Index last, Func &&func, size_t grain = 1) {
+    parallel_for(defaultPool(), first, last, std::forward<Func>(func), grain);
+}
+
+/**
+ * calls func(element) for every element of a random-access container
+ */
+template <typename Container, typename Func>
+void parallel_for(EventLoopPool &pool, Container &container, Func &&func, size_t grain = 1) {
+    auto begin = std::begin(container);
+    parallel_for(pool, size_t(0), (size_t)std::size(container), [&](size_t i) { func(begin[i]); }, grain);
+}
+
+template <typename Container, typename Func, typename = decltype(std::size(std::declval<Container &>()))>
+void parallel_for(Container &container, Func &&func, size_t grain = 1) {
+    parallel_for(defaultPool(), container, std::forward<Func>(func), grain);
+}
+
+/**
+ * reduce(... reduce(reduce(identity, map(first)), map(first + 1)) ..., map(last - 1)), computed in parallel.
+ * reduce must be associative, it does not need to be commutative: partial results are combined in index order.
+ */
+template <typename Index, typename T, typename Map, typename Reduce>
+T parallel_reduce(EventLoopPool &pool, Index first, Index last, T identity, Map &&map, Reduce &&reduce, size_t grain = 1) {
+    static_assert(std::is_integral_v<Index>, "parallel_reduce over an index range needs an integral index");
+    if (first >= last) {
+        return identity;
+    }
+    std::mutex mutex;
+    std::vector<std::pair<size_t, T>> partials;
+    auto body = [&](size_t begin, size_t end) {
+        T acc = identity;
+        for (size_t i = begin; i < end; i++) {
+            acc = reduce(std::move(acc), map((Index)(first + (Index)i)));
+        }
+        std::lock_guard<std::mutex> guard(mutex);
+        partials.emplace_back(begin, std::move(acc));
+    };
+    detail::parallel_chunks(pool, 0, (size_t)(last - first), grain, body);
+
+    std::sort(partials.begin(), partials.end(), [](const auto &a, const auto &b) { return a.first < b.first; });
+    T result = std::move(identity);
+    for (auto &partial : partials) {
+        result = reduce(std::move(result), std::move(partial.second));
+    }
+    return result;
+}
+
+template <typename Index, typename T, typename Map, typename Reduce, typename = std::enable_if_t<std::is_integral_v<Index>>>
+T parallel_reduce(Index first, Index last, T identity, Map &&map, Reduce &&reduce, size_t grain = 1) {
+    return parallel_reduce(
+        defaultPool(), first, last, std::move(identity), std::forward<Map>(map), std::forward<Reduce>(reduce), grain);
+}
+
+/**
+ * the same over the elements of a random-access container, map takes an element
+ */
+template <typename Container, typename T, typename Map, typename Reduce>
+T parallel_reduce(EventLoopPool &pool, Container &container, T identity, Map &&map, Reduce &&reduce, size_t grain = 1) {
+    auto begin = std::begin(container);
+    return parallel_reduce(
+        pool,
+        size_t(0),
+        (size_t)std::size(container),
+        std::move(identity),
+        [&](size_t i) { return map(begin[i]); },
+        std::forward<Reduce>(reduce),
+        grain);
+}
+
+template <
+    typename Container,
+    typename T,
+    typename Map,
+    typename Reduce,
+    typename = decltype(std::size(std::declval<Container &>()))>
+T parallel_reduce(Container &container, T identity, Map &&map, Reduce &&reduce, size_t grain = 1) {
+    return parallel_reduce(
+        defaultPool(), container, std::move(identity), std::forward<Map>(map), std::forward<Reduce>(reduce), grain);
+}
+
+/**
+ * out[i] = func(first[i]) for every element of [first, last), random-access iterators only. returns the end of the
+ * output like std::transform.
+ */
+template <typename InputIt, typename OutputIt, typename Func>
+OutputIt parallel_transform(EventLoopPool &pool, InputIt first, InputIt last, OutputIt out, Func &&func, size_t grain = 1) {
+    static_assert(
+        std::is_base_of_v<std::random_access_iterator_tag, typename std::iterator_traits<InputIt>::iterator_category> &&
+            std::is_base_of_v<
+                std::random_access_iterator_tag,
+                typename std::iterator_traits<OutputIt>::iterator_category>,
+        "parallel_transform needs random-access iterators");
+    auto count = (size_t)std::distance(first, last);
+    parallel_for(pool, size_t(0), count, [&](size_t i) { out[(ptrdiff_t)i] = func(first[(ptrdiff_t)i]); }, grain);
+    return out + (ptrdiff_t)count;
+}
+
+template <typename InputIt, typename OutputIt, typename Func>
+OutputIt parallel_transform(InputIt first, InputIt last, OutputIt out, Func &&func, size_t grain = 1) {
+    return parallel_transform(defaultPool(), first, last, out, std::forward<Func>(func), grain);
+}
+
+} // namespace handycpp
+
+#ifdef HANDYCPP_TEST
+#include <numeric>
+#include <string>
+#include "doctest/doctest.h"
+
+TEST_CASE("handycpp::parallel") {
+    EventLoopPool pool(4);
+
+    std::vector<std::atomic<int>> hits(10000);
+    handycpp::parallel_for(pool, 0, 10000, [&](int i) { hits[(size_t)i]++; });
+    CHECK(std::all_of(hits.begin(), hits.end(), [](const std::atomic<int> &h) { return h.load() == 1; }));
+
+    std::vector<int> values(100000);
+    std::iota(values.begin(), values.end(), 0);
+    handycpp::parallel_for(pool, values, [](int &v) { v *= 2; });
+    CHECK_EQ(values[99999], 199998);
+
+    auto sum = handycpp::parallel_reduce(
+        pool, values, (long long)0, [](int v) { return (long long)v; }, [](long long a, long long b) { return a + b; });
+    CHECK_EQ(sum, 99999LL * 100000);
+
+    // not commutative, partial results must be combined in order
+    auto text = handycpp::parallel_reduce(
+        size_t(0),
+        size_t(26 * 40),
+        std::string(),
+        [](size_t i) { return std::string(1, (char)('a' + i % 26)); },
+        [](std::string a, const std::string &b) { return a + b; });
+    std::string expected;
+    for (int i = 0; i < 40; i++) {
+        expected += "abcdefghijklmnopqrstuvwxyz";
+    }
+    CHECK_EQ(text, expected);
+
+    std::vector<std::string> words{"alpha", "beta", "gamma", "delta"};
+    std::vector<size_t> lengths(words.size());
+    auto end = handycpp::parallel_transform(
+        pool, words.begin(), words.end(), lengths.begin(), [](const std::string &w) { return w.size(); });
+    CHECK(end == lengths.end());
+    CHECK_EQ(lengths, (std::vector<size_t>{5, 4, 5, 5}));
+
+    CHECK_THROWS_AS(
+        handycpp::parallel_for(pool, 0, 1000, [](int i) {
+            if (i == 500) {
+                throw std::runtime_error("boom");
+            }
+        }),
+        std::runtime_error);
+
+    // nested calls from every worker at once must not deadlock
+    std::atomic<int> nested{0};
+    handycpp::parallel_for(pool, 0, 8, [&](int) {
+        handycpp::parallel_for(pool, 0, 100, [&](int) { nested++; });
+    });
+    CHECK_EQ(nested.load(), 800);
+}
+#endif
+
+#endif // HANDYCPP_PARALLEL_H
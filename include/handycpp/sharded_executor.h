@@ -0,0 +1,324 @@
+//
+// Created by zhangfuwen on 2026/10/17.
+//
+
+#ifndef HANDYCPP_SHARDED_EXECUTOR_H
+#define HANDYCPP_SHARDED_EXECUTOR_H
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <vector>
+
+#include "handycpp/event_loop.h"
+
+/**
+ * a fixed set of EventLoops, every key always lands on the same one.
+ *
+ * dispatch(key, task) runs the tasks of one key one after another in the order they were dispatched, so per-key state
+ * needs no lock as long as only that key's tasks touch it. keys are spread with jump consistent hashing, so going from
+ * n to n + 1 shards only moves 1 / (n + 1) of the keys.
+ *
+ * reshard() changes the number of shards without breaking per-key order: tasks dispatched after the switch are held
+ * back until every task dispatched before it has finished, then released in order. it blocks until that is done and
+ * must be called from outside the executor's own threads. with a bounded EventLoop::Options::capacity, its own
+ * bookkeeping tasks and the held back ones are queued past the bound rather than refused or waited for.
+ *
+ * load() reports per shard how many tasks were dispatched to it and its loop's stats(), a shard that stands out there
+ * holds a hot key. shardOf() tells which keys live where.
+ *
+ * options.placement is applied per shard with ThreadPlacement::forWorker, so shards get numbered names and, with
+ * spread, a cpu each.
+ *
+ * as with EventLoop, the executor must outlive every thread that is still dispatching to it, its own tasks included.
+ *
+ * @example
+ * \code{.cpp}
+ * ShardedExecutor sessions(4);
+ * sessions.dispatch(sessionId, [sessionId, event] { table[sessionId].apply(event); });
+ * \endcode
+ */
+class ShardedExecutor {
+public:
+    using callable_t = EventLoop::callable_t;
+
+    struct ShardLoad {
+        uint64_t dispatched = 0; // since the shard was created
+        EventLoop::Stats stats;  // run time and wait histograms need EventLoop::Options::instrument
+    };
+
+    explicit ShardedExecutor(unsigned int shards = std::thread::hardware_concurrency(), EventLoop::Options options = {})
+        : m_options(std::move(options)) {
+        for (unsigned int i = 0; i < std::max(shards, 1u); i++) {
+            m_shards.push_back(std::make_unique<Shard>(m_options, i));
+        }
+    }
+    ShardedExecutor(const ShardedExecutor &) = delete;
+    ShardedExecutor &operator=(const ShardedExecutor &) = delete;
+
+    template <typename Key> void dispatch(const Key &key, callable_t &&task) {
+        dispatchHash(std::hash<Key>{}(key), std::move(task));
+    }
+
+    /**
+     * the enqueueAsync flavour of dispatch
+     */
+    template <typename Key, typename Func, typename... Args>
+    [[nodiscard]] auto dispatchAsync(const Key &key, Func &&callable, Args &&...args) {
+        auto [task, future] = handycpp::makeAsyncTask(std::forward<Func>(callable), std::forward<Args>(args)...);
+        dispatch(key, std::move(task));
+        return std::move(future);
+    }
+
+    template <typename Key> size_t shardOf(const Key &key) const {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return jumpHash(std::hash<Key>{}(key), m_shards.size());
+    }
+
+    size_t size() const {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        return m_shards.size();
+    }
+
+    std::vector<ShardLoad> load() const {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        std::vector<ShardLoad> loads;
+        for (const auto &shard : m_shards) {
+            loads.push_back({shard->dispatched.load(std::memory_order_relaxed), shard->loop.stats()});
+        }
+        return loads;
+    }
+
+    /**
+     * changes the number of shards to count, keeping per-key order. shards that survive keep their loop.
+     */
+    void reshard(unsigned int count) {
+        count = std::max(count, 1u);
+        std::lock_guard<std::mutex> oneAtATime(m_reshardMutex);
+        std::vector<std::unique_ptr<Shard>> retired;
+        std::vector<EventLoop *> fenced;
+        {
+            std::unique_lock<std::shared_mutex> lock(m_mutex);
+            if (count == m_shards.size()) {
+                return;
+            }
+            // no dispatch is in flight now, and from here on new tasks wait in m_held, so nothing reaches the current
+            // shards any more. a fence behind their last task tells us when the old placement has drained
+            m_fencesLeft.store(m_shards.size(), std::memory_order_relaxed);
+            for (auto &shard : m_shards) {
+                fenced.push_back(&shard->loop);
+            }
+            while (m_shards.size() > count) {
+                retired.push_back(std::move(m_shards.back()));
+                m_shards.pop_back();
+            }
+            while (m_shards.size() < count) {
+                m_shards.push_back(std::make_unique<Shard>(m_options, m_shards.size()));
+            }
+            m_held.clear();
+            m_held.resize(count);
+            m_draining = true;
+            std::lock_guard<std::mutex> guard(m_drainMutex);
+            m_drainPending = true;
+        }
+        // forced and outside the lock: a full bounded shard must neither refuse a fence nor make us wait for room while
+        // its tasks need the shared lock to dispatch. retired loops stay alive until we return
+        for (EventLoop *loop : fenced) {
+            loop->enqueueForced([this] {
+                if (m_fencesLeft.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                    releaseHeld();
+                }
+            });
+        }
+
+        std::unique_lock<std::mutex> lock(m_drainMutex);
+        m_drained.wait(lock, [this] { return !m_drainPending; });
+        // retired loops are drained up to their fence and get no new work, destroying them joins their threads
+    }
+
+private:
+    struct Shard {
+        Shard(const EventLoop::Options &options, size_t index) : loop(placed(options, index)) {}
+        static EventLoop::Options placed(EventLoop::Options options, size_t index) {
+            options.placement = options.placement.forWorker(index);
+            return options;
+        }
+        EventLoop loop;
+        std::atomic<uint64_t> dispatched{0};
+    };
+
+    // splitmix64 finaliser, std::hash of an integer is often the integer itself
+    static uint64_t mix(uint64_t x) noexcept {
+        x ^= x >> 30;
+        x *= 0xbf58476d1ce4e5b9ULL;
+        x ^= x >> 27;
+        x *= 0x94d049bb133111ebULL;
+        x ^= x >> 31;
+        return x;
+    }
+
+    // Lamping and Veach, "A Fast, Minimal Memory, Consistent Hash Algorithm"
+    static size_t jumpHash(uint64_t key, size_t buckets) noexcept {
+        key = mix(key);
+        int64_t b = -1;
+        int64_t j = 0;
+        while (j < (int64_t)buckets) {
+            b = j;
+            key = key * 2862933555777941757ULL + 1;
+            j = (int64_t)((double)(b + 1) * ((double)(1LL << 31) / (double)((key >> 33) + 1)));
+        }
+        return (size_t)b;
+    }
+
+    void dispatchHash(size_t hash, callable_t &&task) {
+        std::shared_lock<std::shared_mutex> lock(m_mutex);
+        size_t index = jumpHash(hash, m_shards.size());
+        Shard &shard = *m_shards[index];
+        shard.dispatched.fetch_add(1, std::memory_order_relaxed);
+        if (m_draining) {
+            std::lock_guard<std::mutex> guard(m_heldMutex);
+            m_held[index].push_back(std::move(task));
+            return;
+        }
+        shard.loop.enqueue(std::move(task));
+    }
+
+    // runs on whichever loop passed the last fence
+    void releaseHeld() {
+        {
+            std::unique_lock<std::shared_mutex> lock(m_mutex);
+            // forced like the fences: waiting for room here would hold the exclusive lock against the shard's own tasks
+            for (size_t i = 0; i < m_held.size(); i++) {
+                for (auto &task : m_held[i]) {
+                    m_shards[i]->loop.enqueueForced(std::move(task));
+                }
+            }
+            m_held.clear();
+            m_draining = false;
+        }
+        std::lock_guard<std::mutex> guard(m_drainMutex);
+        m_drainPending = false;
+        m_drained.notify_all();
+    }
+
+    EventLoop::Options m_options;
+    mutable std::shared_mutex m_mutex; // shared for dispatch, exclusive to change the table
+    std::vector<std::unique_ptr<Shard>> m_shards;
+    bool m_draining = false;                  // guarded by m_mutex
+    std::mutex m_heldMutex;                   // dispatchers only share m_mutex, so m_held needs its own
+    std::vector<std::vector<callable_t>> m_held; // tasks dispatched while draining, per new shard
+    std::atomic<size_t> m_fencesLeft{0};
+
+    std::mutex m_reshardMutex;
+    std::mutex m_drainMutex;
+    std::condition_variable m_drained;
+    bool m_drainPending = false; // guarded by m_drainMutex
+};
+
+#ifdef HANDYCPP_TEST
+#include <string>
+#include "doctest/doctest.h"
+
+TEST_CASE("handycpp::sharded_executor") {
+    ShardedExecutor executor(4);
+    CHECK_EQ(executor.size(), 4u);
+
+    // per-key state without locks, each key's last seen sequence number must only grow
+    constexpr int keys = 64;
+    constexpr int perProducer = 2000;
+    struct KeyState {
+        int last = -1;
+        int seen = 0;
+        bool ordered = true;
+    };
+    std::vector<KeyState> state(keys * 2);
+
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 2; p++) {
+        producers.emplace_back([&, p] {
+            for (int seq = 0; seq < perProducer; seq++) {
+                int key = (seq % keys) * 2 + p; // every producer owns its keys, so their order is well defined
+                executor.dispatch(key, [&state, key, seq] {
+                    KeyState &s = state[(size_t)key];
+                    s.ordered = s.ordered && seq > s.last;
+                    s.last = seq;
+                    s.seen++;
+                });
+            }
+        });
+    }
+    executor.reshard(7);
+    CHECK_EQ(executor.size(), 7u);
+    executor.reshard(2);
+    CHECK_EQ(executor.size(), 2u);
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    for (int key = 0; key < keys * 2; key++) {
+        executor.dispatchAsync(key, [] {}).get();
+    }
+
+    int seen = 0;
+    bool ordered = true;
+    for (auto &s : state) {
+        seen += s.seen;
+        ordered = ordered && s.ordered;
+    }
+    CHECK_EQ(seen, 2 * perProducer);
+    CHECK(ordered);
+
+    // a hot key shows up as one busy shard
+    for (int i = 0; i < 1000; i++) {
+        executor.dispatch(std::string("hot"), [] {});
+    }
+    auto loads = executor.load();
+    REQUIRE_EQ(loads.size(), 2u);
+    size_t hot = executor.shardOf(std::string("hot"));
+    CHECK_GE(loads[hot].dispatched, 1000u);
+}
+
+TEST_CASE("handycpp::sharded_executor reshard with a full bounded shard") {
+    EventLoop::Options options;
+    options.capacity = 1;
+    options.overflow = EventLoop::Overflow::Fail;
+    ShardedExecutor executor(2, options);
+
+    std::promise<void> started;
+    std::promise<void> gate;
+    std::shared_future<void> open = gate.get_future().share();
+    std::atomic<int> ran{0};
+    executor.dispatch(0, [&started, open, &ran] {
+        started.set_value();
+        open.wait();
+        ran++;
+    });
+    started.get_future().wait();
+    executor.dispatch(0, [&ran] { ran++; }); // the shard is full now
+    size_t busy = executor.shardOf(0);
+
+    std::thread resharder([&executor] { executor.reshard(3); });
+    // the fence is queued past the bound, a refused one would leave reshard waiting forever
+    while (executor.load()[busy].stats.queueDepth < 2) {
+        std::this_thread::yield();
+    }
+    std::promise<void> done;
+    executor.dispatch(0, [&ran, &done] { // held back until the fence has passed
+        ran++;
+        done.set_value();
+    });
+    gate.set_value();
+    resharder.join();
+
+    CHECK_EQ(executor.size(), 3u);
+    done.get_future().wait();
+    CHECK_EQ(ran.load(), 3);
+}
+#endif
+
+#endif // HANDYCPP_SHARDED_EXECUTOR_H
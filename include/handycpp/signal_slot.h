@@ -4,9 +4,407 @@
 
 #ifndef HANDYCPP_SIGNAL_H
 #define HANDYCPP_SIGNAL_H
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstring>
 #include <functional>
-#include <map>
+#include <iterator>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
 
+namespace handycpp {
+
+template <typename Signature> class Delegate;
+
+// A callable reference that is cheap to store and to call: an object pointer plus a
+// member function pointer, a function pointer, or any small trivially copyable callable
+// such as a lambda that captures nothing or only pointers, is kept inline and reached
+// through a single indirect call. Everything else is kept in a std::function, so copies
+// of the delegate copy the target just as copies of a std::function would. Null function
+// and member pointers, a null object and an empty std::function make an empty delegate.
+//
+//   handycpp::Delegate<void(int)> d(&widget, &Widget::resize);
+//   d(42);
+template <typename R, typename... Args> class Delegate<R(Args...)> {
+public:
+    Delegate() noexcept = default;
+    Delegate(std::nullptr_t) noexcept {}
+
+    template <typename T> Delegate(T *object, R (T::*method)(Args...)) noexcept {
+        if (object != nullptr && method != nullptr) {
+            store(Bound<T, R (T::*)(Args...)>{object, method});
+        }
+    }
+
+    template <typename T> Delegate(T const *object, R (T::*method)(Args...) const) noexcept {
+        if (object != nullptr && method != nullptr) {
+            store(Bound<T const, R (T::*)(Args...) const>{object, method});
+        }
+    }
+
+    template <
+        typename F,
+        typename = std::enable_if_t<
+            !std::is_same_v<std::decay_t<F>, Delegate> && std::is_invocable_r_v<R, std::decay_t<F> &, Args...>>>
+    Delegate(F &&func) {
+        using func_type = std::decay_t<F>;
+        if constexpr (std::is_pointer_v<func_type> || std::is_member_pointer_v<func_type>) {
+            if (func == nullptr) {
+                return;
+            }
+        } else if constexpr (std::is_same_v<func_type, std::function<R(Args...)>>) {
+            if (!func) {
+                return;
+            }
+        }
+        store(std::forward<F>(func));
+    }
+
+    Delegate(Delegate const &) = default;
+    Delegate(Delegate &&other) noexcept
+        : m_stub(std::exchange(other.m_stub, nullptr)), m_fallback(std::move(other.m_fallback)) {
+        std::memcpy(m_storage, other.m_storage, sizeof(m_storage));
+    }
+    Delegate &operator=(Delegate const &) = default;
+    Delegate &operator=(Delegate &&other) noexcept {
+        if (this != &other) {
+            m_stub = std::exchange(other.m_stub, nullptr);
+            m_fallback = std::move(other.m_fallback);
+            std::memcpy(m_storage, other.m_storage, sizeof(m_storage));
+        }
+        return *this;
+    }
+    ~Delegate() = default;
+
+    R operator()(Args... args) const { return m_stub(*this, std::forward<Args>(args)...); }
+
+    explicit operator bool() const noexcept { return m_stub != nullptr; }
+
+private:
+    template <typename T, typename Method> struct Bound {
+        T *object;
+        Method method;
+        R operator()(Args... args) const { return (object->*method)(std::forward<Args>(args)...); }
+    };
+
+    static constexpr size_t kInline = 3 * sizeof(void *); // object + member function pointer
+
+    template <typename F>
+    static constexpr bool fits_inline = sizeof(F) <= kInline && alignof(F) <= alignof(void *) &&
+                                        std::is_trivially_copyable_v<F> && std::is_trivially_destructible_v<F>;
+
+    template <typename F> void store(F &&func) {
+        using func_type = std::decay_t<F>;
+        if constexpr (fits_inline<func_type>) {
+            new (m_storage) func_type(std::forward<F>(func));
+            m_stub = &callInline<func_type>;
+        } else {
+            m_fallback = std::forward<F>(func);
+            m_stub = &callFallback;
+        }
+    }
+
+    // A void delegate drops whatever the target returns, like std::function does.
+    template <typename F> static R invoke(F &func, Args &&...args) {
+        if constexpr (std::is_void_v<R>) {
+            std::invoke(func, std::forward<Args>(args)...);
+        } else {
+            return std::invoke(func, std::forward<Args>(args)...);
+        }
+    }
+    template <typename F> static R callInline(Delegate const &self, Args &&...args) {
+        return invoke(*reinterpret_cast<F *>(const_cast<unsigned char *>(self.m_storage)), std::forward<Args>(args)...);
+    }
+    static R callFallback(Delegate const &self, Args &&...args) { return self.m_fallback(std::forward<Args>(args)...); }
+
+    alignas(void *) unsigned char m_storage[kInline] = {};
+    R (*m_stub)(Delegate const &, Args &&...) = nullptr;
+    std::function<R(Args...)> m_fallback; // Empty unless the target does not fit inline
+};
+
+} // namespace handycpp
+
+#if defined(HANDYCPP_EVENT_LOOP_H)
+#include <optional>
+#include <tuple>
+
+namespace handycpp {
+// How a queued connection delivers emits to its loop.
+enum class Queued {
+    Every,  // Every emit is delivered, in emit order
+    Latest, // Only the newest arguments not yet delivered are, one delivery task in flight at a time
+};
+} // namespace handycpp
+
+namespace handycpp::detail {
+// Where an emit was called from, so the loop's slow-task watchdog can name it.
+using EmitSite = EventLoop::CallSite;
+
+// The queued connections of a signal, grouped by the loop they run on. An emit stores its
+// arguments once and posts one task per loop that runs all of that loop's slots, instead
+// of one task and one future per slot. The per-loop lists are immutable and replaced on
+// change, so a posted task simply keeps the list it was posted with.
+//
+// Queued::Latest connections are kept apart: each holds at most one pending argument
+// tuple, which an emit overwrites, and posts a delivery task only when none is in flight.
+// A producer that outruns the loop therefore costs a bounded amount of memory and the
+// slot always sees the newest value instead of working through stale ones.
+template <typename... Args> class QueuedSlots {
+public:
+    using slot_t = Delegate<void(Args...)>;
+
+    void add(EventLoop *loop, int id, slot_t const &slot, Queued mode) {
+        if (mode == Queued::Latest) {
+            _latest.push_back(LatestTarget{id, std::make_shared<Latest>(loop, slot)});
+            return;
+        }
+        add(loop, id, slot);
+    }
+
+    void add(EventLoop *loop, int id, slot_t const &slot) {
+        auto group = std::find_if(_groups.begin(), _groups.end(), [loop](Group const &g) { return g.loop == loop; });
+        if (group == _groups.end()) {
+            _groups.push_back(Group{loop, std::make_shared<std::vector<Target> const>(1, Target{id, slot})});
+            return;
+        }
+        auto targets = std::make_shared<std::vector<Target>>(*group->targets);
+        targets->push_back(Target{id, slot});
+        group->targets = std::move(targets);
+    }
+
+    void remove(int id) {
+        auto latest = std::find_if(_latest.begin(), _latest.end(), [id](LatestTarget const &t) { return t.id == id; });
+        if (latest != _latest.end()) {
+            latest->state->close();
+            _latest.erase(latest);
+            return;
+        }
+        for (auto group = _groups.begin(); group != _groups.end(); ++group) {
+            auto const &old = *group->targets;
+            auto it = std::find_if(old.begin(), old.end(), [id](Target const &t) { return t.id == id; });
+            if (it == old.end()) {
+                continue;
+            }
+            if (old.size() == 1) {
+                _groups.erase(group);
+                return;
+            }
+            auto targets = std::make_shared<std::vector<Target>>(old);
+            targets->erase(targets->begin() + (it - old.begin()));
+            group->targets = std::move(targets);
+            return;
+        }
+    }
+
+    void clear() {
+        close();
+        _groups.clear();
+        _latest.clear();
+    }
+
+    // Drops what Latest connections still have pending and stops them taking more, without
+    // touching the lists themselves, which emits running on other threads may be reading.
+    void close() const {
+        for (auto const &target : _latest) {
+            target.state->close();
+        }
+    }
+
+    // One task per loop, excluded is a connection id to leave out, 0 for none.
+    void post(int excluded, EmitSite site, Args &...p) const {
+        for (auto const &target : _latest) {
+            if (target.id != excluded) {
+                offer(target.state, site, p...);
+            }
+        }
+        if (_groups.empty()) {
+            return;
+        }
+        auto stored = std::make_shared<std::tuple<bound_arg_t<Args>...> const>(p...);
+        for (auto const &group : _groups) {
+            auto run = [targets = group.targets, stored, excluded] {
+                for (auto const &target : *targets) {
+                    if (target.id != excluded) {
+                        call(target.func, *stored);
+                    }
+                }
+            };
+            group.loop->enqueue(std::move(run), EventLoop::Priority::Normal, site);
+        }
+    }
+
+    // Posts the slot connected as id on its own, for emit_for().
+    void postTo(int id, EmitSite site, Args &...p) const {
+        for (auto const &target : _latest) {
+            if (target.id == id) {
+                offer(target.state, site, p...);
+                return;
+            }
+        }
+        for (auto const &group : _groups) {
+            auto const &targets = *group.targets;
+            for (size_t i = 0; i < targets.size(); i++) {
+                if (targets[i].id == id) {
+                    // Calls the listed slot rather than a copy of it, so a stateful one keeps its state
+                    auto run = [targets = group.targets, i, stored = std::tuple<bound_arg_t<Args>...>(p...)] {
+                        call((*targets)[i].func, stored);
+                    };
+                    group.loop->enqueue(std::move(run), EventLoop::Priority::Normal, site);
+                    return;
+                }
+            }
+        }
+    }
+
+private:
+    struct Target {
+        int id;
+        slot_t func;
+    };
+    struct Group {
+        EventLoop *loop;
+        std::shared_ptr<std::vector<Target> const> targets;
+    };
+
+    struct Latest {
+        Latest(EventLoop *loop, slot_t const &slot) : loop(loop), slot(slot) {}
+
+        void close() {
+            std::lock_guard<std::mutex> guard(mutex);
+            closed = true;
+            pending.reset();
+        }
+
+        EventLoop *const loop;
+        slot_t const slot;
+        std::mutex mutex; // Guards the rest, only held to swap arguments in and out
+        std::optional<std::tuple<bound_arg_t<Args>...>> pending;
+        bool scheduled = false; // A delivery task is posted or running
+        bool closed = false;
+    };
+    struct LatestTarget {
+        int id;
+        std::shared_ptr<Latest> state;
+    };
+
+    static void offer(std::shared_ptr<Latest> const &latest, EmitSite site, Args &...p) {
+        {
+            std::lock_guard<std::mutex> guard(latest->mutex);
+            if (latest->closed) {
+                return;
+            }
+            latest->pending.emplace(p...); // Replaces whatever the loop has not picked up yet
+            if (latest->scheduled) {
+                return;
+            }
+            latest->scheduled = true;
+        }
+        latest->loop->enqueue(Delivery(latest, site), EventLoop::Priority::Normal, site);
+    }
+
+    // The delivery task. One that is destroyed unrun, dropped by a bounded loop or left
+    // behind by a destroyed one, clears scheduled so the next emit posts a fresh one.
+    struct Delivery {
+        Delivery(std::shared_ptr<Latest> latest, EmitSite site) noexcept : latest(std::move(latest)), site(site) {}
+        Delivery(Delivery &&) noexcept = default;
+        Delivery &operator=(Delivery &&) = delete;
+        ~Delivery() {
+            if (latest != nullptr) {
+                std::lock_guard<std::mutex> guard(latest->mutex);
+                latest->scheduled = false;
+            }
+        }
+        void operator()() { deliver(std::move(latest), site); }
+
+        std::shared_ptr<Latest> latest;
+        EmitSite site;
+    };
+
+    // Loop thread. Values that arrive while the slot runs are picked up by a fresh task
+    // rather than in a loop here, so a busy producer cannot keep the loop to itself.
+    static void deliver(std::shared_ptr<Latest> latest, EmitSite site) {
+        std::optional<std::tuple<bound_arg_t<Args>...>> stored;
+        {
+            std::lock_guard<std::mutex> guard(latest->mutex);
+            stored.swap(latest->pending);
+            if (!stored) {
+                latest->scheduled = false; // Closed since the task was posted
+                return;
+            }
+        }
+        call(latest->slot, *stored);
+        {
+            std::lock_guard<std::mutex> guard(latest->mutex);
+            if (!latest->pending) {
+                latest->scheduled = false;
+                return;
+            }
+        }
+        EventLoop *loop = latest->loop;
+        loop->enqueue(Delivery(std::move(latest), site), EventLoop::Priority::Normal, site);
+    }
+
+    // References reach the slot as references. Values are shared by every slot of the
+    // emit, so they are handed out as const lvalues, or copied for rvalue reference slots.
+    template <typename Arg, typename Stored> static decltype(auto) pass(Stored const &stored) {
+        if constexpr (std::is_lvalue_reference_v<Arg>) {
+            return stored.get();
+        } else if constexpr (std::is_rvalue_reference_v<Arg>) {
+            return std::decay_t<Arg>(stored);
+        } else {
+            return (stored);
+        }
+    }
+
+    // Queued slots used to run inside a discarded future, which swallowed their exceptions.
+    // Keep doing that, and keep the loop's other slots running.
+    template <typename Tuple> static void call(slot_t const &slot, Tuple const &stored) noexcept {
+        try {
+            std::apply([&](auto const &...a) { slot(pass<Args>(a)...); }, stored);
+        } catch (...) {
+        }
+    }
+
+    std::vector<Group> _groups;
+    std::vector<LatestTarget> _latest;
+};
+} // namespace handycpp::detail
+#else
+namespace handycpp::detail {
+// Without an event loop there is nobody to report the emit site to.
+struct EmitSite {
+    static constexpr EmitSite current() noexcept { return {}; }
+};
+} // namespace handycpp::detail
+#endif
+
+namespace handycpp::detail {
+// Every slot of an emit gets the same arguments, so only rvalue reference parameters are
+// moved from, by-value ones are copied from p instead of the first slot stealing it.
+template <typename Arg, typename T> decltype(auto) pass_slot_arg(T &p) {
+    if constexpr (std::is_rvalue_reference_v<Arg>) {
+        return std::move(p);
+    } else {
+        return (p);
+    }
+}
+} // namespace handycpp::detail
+
+// Slots live in one contiguous array in connection order, so emit() is a linear walk
+// instead of a tree traversal. Connection ids grow monotonically and are never reused,
+// which keeps the array sorted by id: disconnect() and emit_for() binary search it, and
+// a stale id can never hit a slot connected later.
+//
+// disconnect() only marks the slot dead, the array is compacted once no emit is running.
+// Slots may therefore connect and disconnect, themselves included, from inside an emit.
+// A slot connected during an emit is first called by the next one, except for queued
+// slots: they are posted after the direct slots have run, as connected at that point.
 template <typename... Args>
 class Signal {
 
@@ -25,94 +423,823 @@ public:
     }
 
     // Move constructor and assignment operator work as expected.
-    Signal(Signal &&other) noexcept : _slots(std::move(other._slots)), _current_id(other._current_id) {}
+    Signal(Signal &&other) noexcept
+        : _slots(std::move(other._slots)), _added(std::move(other._added)), _dead(other._dead),
+#if defined(HANDYCPP_EVENT_LOOP_H)
+          _queued(std::move(other._queued)),
+#endif
+          _current_id(other._current_id) {}
 
     Signal &operator=(Signal &&other) noexcept {
         if (this != &other) {
             _slots = std::move(other._slots);
+            _added = std::move(other._added);
+            _dead = other._dead;
+#if defined(HANDYCPP_EVENT_LOOP_H)
+            _queued = std::move(other._queued);
+#endif
             _current_id = other._current_id;
         }
 
         return *this;
     }
 
-    // Connects a std::function to the signal. The returned
-    // value can be used to disconnect the function again.
-    int connect(std::function<void(Args...)> const &slot) const {
-        _slots.insert(std::make_pair(++_current_id, slot));
-        return _current_id;
-    }
+    // Connects a function to the signal, see handycpp::Delegate for what is stored how.
+    // The returned value can be used to disconnect the function again.
+    int connect(handycpp::Delegate<void(Args...)> slot) const { return insert(std::move(slot), false); }
 
     // Convenience method to connect a member function of an
     // object to this Signal.
     template <typename T> int connect_member(T *inst, void (T::*func)(Args...)) {
-        return connect([=](Args... args) { (inst->*func)(args...); });
+        return connect(handycpp::Delegate<void(Args...)>(inst, func));
     }
 
     // Convenience method to connect a const member function
     // of an object to this Signal.
     template <typename T> int connect_member(T *inst, void (T::*func)(Args...) const) {
-        return connect([=](Args... args) { (inst->*func)(args...); });
+        return connect(handycpp::Delegate<void(Args...)>(inst, func));
     }
 
 #if defined(HANDYCPP_EVENT_LOOP_H)
-    // Connects a std::function to the signal. The returned
-    // value can be used to disconnect the function again.
-    int connect(std::function<void(Args...)> const &slot, EventLoop * loop) const {
-        _slots.insert(std::make_pair(++_current_id, [=](Args... args) {
-            [[maybe_unused]] auto ret = loop->enqueueAsync(slot, std::forward<Args>(args)...);
-        }));
-        return _current_id;
+    // Connects a std::function that is run on loop's thread. An emit posts one task per
+    // loop for all slots connected to it, and copies the arguments once for all of them.
+    // With Queued::Latest the slot only gets the newest arguments that are still pending
+    // when the loop comes round to it, for producers that emit faster than it consumes.
+    int connect(handycpp::Delegate<void(Args...)> const &slot, EventLoop *loop,
+                handycpp::Queued mode = handycpp::Queued::Every) const {
+        int id = insert(nullptr, true);
+        _queued.add(loop, id, slot, mode);
+        return id;
     }
 
     // Convenience method to connect a member function of an
     // object to this Signal.
-    template <typename T> int connect_member(T *inst, void (T::*func)(Args...), EventLoop * loop) {
-        return connect([=](Args... args) { (inst->*func)(std::forward<Args>(args)...); }, loop);
+    template <typename T>
+    int connect_member(T *inst, void (T::*func)(Args...), EventLoop *loop,
+                       handycpp::Queued mode = handycpp::Queued::Every) {
+        return connect(handycpp::Delegate<void(Args...)>(inst, func), loop, mode);
     }
 
     // Convenience method to connect a const member function
     // of an object to this Signal.
-    template <typename T> int connect_member(T *inst, void (T::*func)(Args...) const, EventLoop *loop) {
-        return connect([=](Args... args) { (inst->*func)(std::forward<Args>(args)...); }, loop);
+    template <typename T>
+    int connect_member(T *inst, void (T::*func)(Args...) const, EventLoop *loop,
+                       handycpp::Queued mode = handycpp::Queued::Every) {
+        return connect(handycpp::Delegate<void(Args...)>(inst, func), loop, mode);
     }
 #endif
 
     // Disconnects a previously connected function.
-    void disconnect(int id) const { _slots.erase(id); }
+    void disconnect(int id) const {
+        Slot *slot = find(id);
+        if (slot == nullptr) {
+            return;
+        }
+        kill(*slot);
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        if (slot->queued) {
+            _queued.remove(id);
+        }
+#endif
+        if (_emitting == 0 && _dead * 4 > _slots.size()) {
+            compact();
+        }
+    }
 
     // Disconnects all previously connected functions.
-    void disconnect_all() const { _slots.clear(); }
+    void disconnect_all() const {
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        _queued.clear();
+#endif
+        if (_emitting > 0) {
+            for (auto &slot : _slots) {
+                kill(slot);
+            }
+            _added.clear();
+            return;
+        }
+        _slots.clear();
+        _dead = 0;
+    }
 
-    // Calls all connected functions.
-    void emit(Args... p) {
-        for (auto const &it : _slots) {
-            it.second(std::forward<Args>(p)...);
+    // Calls all connected functions. site is what a queued slot's loop reports to its
+    // slow-task watchdog.
+    void emit(
+        Args... p,
+        [[maybe_unused]] handycpp::detail::EmitSite site = handycpp::detail::EmitSite::current()) {
+        Emitting guard(*this);
+        size_t count = _slots.size();
+        for (size_t i = 0; i < count; i++) {
+            if (_slots[i].live && !_slots[i].queued) {
+                _slots[i].func(handycpp::detail::pass_slot_arg<Args>(p)...);
+            }
         }
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        _queued.post(0, site, p...); // After the direct slots, a queued slot never ran before them
+#endif
     }
 
     // Calls all connected functions except for one.
-    void emit_for_all_but_one(int excludedConnectionID, Args... p) {
-        for (auto const &it : _slots) {
-            if (it.first != excludedConnectionID) {
-                it.second(std::forward<Args>(p)...);
+    void emit_for_all_but_one(
+        int excludedConnectionID,
+        Args... p,
+        [[maybe_unused]] handycpp::detail::EmitSite site = handycpp::detail::EmitSite::current()) {
+        Emitting guard(*this);
+        size_t count = _slots.size();
+        for (size_t i = 0; i < count; i++) {
+            if (_slots[i].live && !_slots[i].queued && _slots[i].id != excludedConnectionID) {
+                _slots[i].func(handycpp::detail::pass_slot_arg<Args>(p)...);
             }
         }
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        _queued.post(excludedConnectionID, site, p...);
+#endif
     }
 
     // Calls only one connected function.
-    void emit_for(int connectionID, Args... p) {
-        auto const &it = _slots.find(connectionID);
-        if (it != _slots.end()) {
-            it->second(std::forward<Args>(p)...);
+    void emit_for(
+        int connectionID,
+        Args... p,
+        [[maybe_unused]] handycpp::detail::EmitSite site = handycpp::detail::EmitSite::current()) {
+        Emitting guard(*this);
+        bool added = false;
+        Slot *slot = find(connectionID, &added);
+        if (slot == nullptr) {
+            return;
         }
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        if (slot->queued) {
+            _queued.postTo(connectionID, site, p...);
+            return;
+        }
+#endif
+        if (added) {
+            // Connected by the emit we are nested in, _added may grow while it runs
+            auto func = slot->func;
+            func(std::forward<Args>(p)...);
+            return;
+        }
+        slot->func(std::forward<Args>(p)...);
     }
 
 private:
-    mutable std::map<int, std::function<void(Args...)>> _slots;
+    struct Slot {
+        int id;
+        bool live;
+        bool queued; // Emitted through _queued, func is empty
+        handycpp::Delegate<void(Args...)> func;
+    };
+
+    int insert(handycpp::Delegate<void(Args...)> &&func, bool queued) const {
+        // Appending while an emit walks _slots could move the slot that is running
+        (_emitting > 0 ? _added : _slots).push_back(Slot{++_current_id, true, queued, std::move(func)});
+        return _current_id;
+    }
+
+    // Defers compaction until the outermost emit returns.
+    struct Emitting {
+        Signal const &signal;
+        explicit Emitting(Signal const &s) : signal(s) { signal._emitting++; }
+        ~Emitting() {
+            if (--signal._emitting == 0) {
+                signal.settle();
+            }
+        }
+    };
+
+    // The live slot with this id, or nullptr. added tells whether it was connected during the running emit.
+    Slot *find(int id, bool *added = nullptr) const {
+        for (auto *slots : {&_slots, &_added}) {
+            auto it = std::lower_bound(
+                slots->begin(), slots->end(), id, [](Slot const &slot, int key) { return slot.id < key; });
+            if (it != slots->end() && it->id == id) {
+                if (added != nullptr) {
+                    *added = slots == &_added;
+                }
+                return it->live ? &*it : nullptr;
+            }
+        }
+        return nullptr;
+    }
+
+    void kill(Slot &slot) const {
+        if (!slot.live) {
+            return;
+        }
+        slot.live = false;
+        _dead++;
+        if (_emitting == 0) {
+            slot.func = nullptr; // Release the captures right away, a running slot keeps its own until compaction
+        }
+    }
+
+    void compact() const {
+        _slots.erase(
+            std::remove_if(_slots.begin(), _slots.end(), [](Slot const &slot) { return !slot.live; }), _slots.end());
+        _dead = 0;
+    }
+
+    void settle() const {
+        if (!_added.empty()) {
+            // Slots added during an emit have larger ids than everything in _slots
+            std::move(_added.begin(), _added.end(), std::back_inserter(_slots));
+            _added.clear();
+        }
+        if (_dead > 0) {
+            compact();
+        }
+    }
+
+    mutable std::vector<Slot> _slots;
+    mutable std::vector<Slot> _added; // Connected during an emit
+    mutable size_t _dead{0};          // Disconnected slots still in _slots
+    mutable int _emitting{0};         // Nesting depth of running emits
+#if defined(HANDYCPP_EVENT_LOOP_H)
+    mutable handycpp::detail::QueuedSlots<Args...> _queued;
+#endif
     mutable int _current_id{0};
 };
+namespace handycpp::detail {
+// How many ConcurrentSignal emits the current thread is inside of, of any signal type.
+inline int &signal_emit_depth() noexcept {
+    static thread_local int depth = 0;
+    return depth;
+}
+} // namespace handycpp::detail
+
+// A Signal that may be emitted from any number of threads while others connect and
+// disconnect.
+//
+// emit() never takes a lock: it walks an immutable snapshot of the slot list. connect()
+// and disconnect() copy the list under a mutex and publish the copy, then release the
+// mutex and wait until no emit can still be reading an old snapshot before freeing it
+// (read-copy-update with two reader counters, so a steady stream of emits can not hold a
+// writer off forever). Slots running on any thread may therefore connect and disconnect.
+//
+// Once disconnect() returns, the slot will not be called again and whatever it captured
+// may be destroyed. The exception is a disconnect() from inside a slot: emits running on
+// other threads may still finish their call of it, and the old snapshot is freed by a
+// later connect/disconnect or by the destructor. For the same reason do not call
+// connect/disconnect while holding a lock that a slot takes.
+//
+// Writers copy the whole list, so this is for signals that are emitted far more often
+// than they are (dis)connected. A slot that throws ends the emit.
+template <typename... Args>
+class ConcurrentSignal {
+public:
+    using slot_t = handycpp::Delegate<void(Args...)>;
+
+    ConcurrentSignal() = default;
+    ConcurrentSignal(ConcurrentSignal const &) = delete;
+    ConcurrentSignal &operator=(ConcurrentSignal const &) = delete;
+
+    // Must not race with any other call.
+    ~ConcurrentSignal() {
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        _current.load(std::memory_order_relaxed)->queued.close();
+#endif
+        delete _current.load(std::memory_order_relaxed);
+        for (auto *snapshot : _retired) {
+            delete snapshot;
+        }
+    }
+
+    // Connects a function to the signal. The returned
+    // value can be used to disconnect the function again.
+    int connect(slot_t slot) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto *next = copy();
+        int id = ++_current_id;
+        next->slots.push_back(Slot{id, false, std::make_shared<const slot_t>(std::move(slot))});
+        publish(next, lock);
+        return id;
+    }
+
+    // Convenience method to connect a member function of an
+    // object to this Signal.
+    template <typename T> int connect_member(T *inst, void (T::*func)(Args...)) { return connect(slot_t(inst, func)); }
+
+    // Convenience method to connect a const member function
+    // of an object to this Signal.
+    template <typename T> int connect_member(T *inst, void (T::*func)(Args...) const) {
+        return connect(slot_t(inst, func));
+    }
+
+#if defined(HANDYCPP_EVENT_LOOP_H)
+    // Connects a std::function that is run on loop's thread, see Signal::connect.
+    int connect(slot_t const &slot, EventLoop *loop, handycpp::Queued mode = handycpp::Queued::Every) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto *next = copy();
+        int id = ++_current_id;
+        next->slots.push_back(Slot{id, true, nullptr});
+        next->queued.add(loop, id, slot, mode);
+        publish(next, lock);
+        return id;
+    }
+
+    template <typename T>
+    int connect_member(T *inst, void (T::*func)(Args...), EventLoop *loop,
+                       handycpp::Queued mode = handycpp::Queued::Every) {
+        return connect(slot_t(inst, func), loop, mode);
+    }
+
+    template <typename T>
+    int connect_member(T *inst, void (T::*func)(Args...) const, EventLoop *loop,
+                       handycpp::Queued mode = handycpp::Queued::Every) {
+        return connect(slot_t(inst, func), loop, mode);
+    }
+#endif
+
+    // Disconnects a previously connected function.
+    void disconnect(int id) {
+        std::unique_lock<std::mutex> lock(_mutex);
+        auto const &slots = _current.load(std::memory_order_relaxed)->slots;
+        if (find(slots, id) == slots.end()) {
+            return;
+        }
+        auto *next = new Snapshot;
+        next->slots.reserve(slots.size() - 1);
+        std::copy_if(slots.begin(), slots.end(), std::back_inserter(next->slots), [id](Slot const &slot) {
+            return slot.id != id;
+        });
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        next->queued = _current.load(std::memory_order_relaxed)->queued;
+        next->queued.remove(id);
+#endif
+        publish(next, lock);
+    }
+
+    // Disconnects all previously connected functions.
+    void disconnect_all() {
+        std::unique_lock<std::mutex> lock(_mutex);
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        _current.load(std::memory_order_relaxed)->queued.close();
+#endif
+        publish(new Snapshot, lock);
+    }
+
+    // Calls all connected functions, see Signal::emit for site.
+    void emit(
+        Args... p,
+        [[maybe_unused]] handycpp::detail::EmitSite site = handycpp::detail::EmitSite::current()) const {
+        ReadSection read(*this);
+        for (auto const &slot : read.snapshot->slots) {
+            if (!slot.queued) {
+                (*slot.func)(handycpp::detail::pass_slot_arg<Args>(p)...);
+            }
+        }
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        read.snapshot->queued.post(0, site, p...);
+#endif
+    }
+
+    // Calls all connected functions except for one.
+    void emit_for_all_but_one(
+        int excludedConnectionID,
+        Args... p,
+        [[maybe_unused]] handycpp::detail::EmitSite site = handycpp::detail::EmitSite::current()) const {
+        ReadSection read(*this);
+        for (auto const &slot : read.snapshot->slots) {
+            if (!slot.queued && slot.id != excludedConnectionID) {
+                (*slot.func)(handycpp::detail::pass_slot_arg<Args>(p)...);
+            }
+        }
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        read.snapshot->queued.post(excludedConnectionID, site, p...);
+#endif
+    }
+
+    // Calls only one connected function.
+    void emit_for(
+        int connectionID,
+        Args... p,
+        [[maybe_unused]] handycpp::detail::EmitSite site = handycpp::detail::EmitSite::current()) const {
+        ReadSection read(*this);
+        auto it = find(read.snapshot->slots, connectionID);
+        if (it == read.snapshot->slots.end()) {
+            return;
+        }
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        if (it->queued) {
+            read.snapshot->queued.postTo(connectionID, site, p...);
+            return;
+        }
+#endif
+        (*it->func)(std::forward<Args>(p)...);
+    }
+
+private:
+    struct Slot {
+        int id;
+        bool queued;                        // Emitted through Snapshot::queued, func is empty
+        std::shared_ptr<const slot_t> func; // Shared by every snapshot the slot is in
+    };
+
+    struct Snapshot {
+        std::vector<Slot> slots; // Sorted by id
+#if defined(HANDYCPP_EVENT_LOOP_H)
+        handycpp::detail::QueuedSlots<Args...> queued;
+#endif
+    };
+
+    // Pins the current snapshot for the duration of an emit.
+    struct ReadSection {
+        ConcurrentSignal const &signal;
+        std::atomic<size_t> &readers;
+        Snapshot const *snapshot;
+
+        explicit ReadSection(ConcurrentSignal const &s)
+            : signal(s), readers(s._readers[s._epoch.load(std::memory_order_acquire) & 1]) {
+            // Dekker style: the writer publishes and then looks at the counters, we count
+            // ourselves and then load, so one of us sees the other
+            readers.fetch_add(1, std::memory_order_seq_cst);
+            snapshot = signal._current.load(std::memory_order_seq_cst);
+            handycpp::detail::signal_emit_depth()++;
+        }
+        ~ReadSection() {
+            handycpp::detail::signal_emit_depth()--;
+            readers.fetch_sub(1, std::memory_order_release);
+        }
+    };
+
+    static typename std::vector<Slot>::const_iterator find(std::vector<Slot> const &slots, int id) {
+        auto it = std::lower_bound(slots.begin(), slots.end(), id, [](Slot const &slot, int key) { return slot.id < key; });
+        return it != slots.end() && it->id == id ? it : slots.end();
+    }
+
+    // Guarded by _mutex.
+    Snapshot *copy() const { return new Snapshot(*_current.load(std::memory_order_relaxed)); }
+
+    // Called with lock holding _mutex, which is released before waiting for readers: a
+    // slot running on another thread may connect or disconnect while we wait for its emit.
+    void publish(Snapshot *next, std::unique_lock<std::mutex> &lock) {
+        _retired.push_back(_current.exchange(next, std::memory_order_seq_cst));
+        if (handycpp::detail::signal_emit_depth() > 0) {
+            return; // Waiting would wait for ourselves, a later writer frees it
+        }
+        std::vector<Snapshot *> retired;
+        retired.swap(_retired);
+        lock.unlock();
+
+        // Every reader that may hold a retired snapshot counted itself in one of the two
+        // counters. Flip new readers over to the other counter and wait for the old one to
+        // drain, twice, so readers that picked a counter just before a flip are covered too.
+        // Grace periods are serialized, concurrent flips would skip a counter.
+        {
+            std::lock_guard<std::mutex> grace(_graceMutex);
+            for (int i = 0; i < 2; i++) {
+                size_t epoch = _epoch.fetch_add(1, std::memory_order_seq_cst);
+                while (_readers[epoch & 1].load(std::memory_order_acquire) != 0) {
+                    std::this_thread::yield();
+                }
+            }
+        }
+        for (auto *snapshot : retired) {
+            delete snapshot;
+        }
+    }
+
+    std::atomic<Snapshot *> _current{new Snapshot};
+    mutable std::atomic<size_t> _readers[2] = {};
+    std::atomic<size_t> _epoch{0};
+    std::mutex _mutex;
+    std::mutex _graceMutex;           // Never taken by a thread inside an emit
+    std::vector<Snapshot *> _retired; // Replaced snapshots an emit may still read, guarded by _mutex
+    int _current_id{0};
+};
+
 #ifdef HANDYCPP_TEST
+int delegate_twice(int v) { return v * 2; }
+
+TEST_CASE("handycpp::delegate") {
+    using handycpp::Delegate;
+    struct Counter {
+        int total = 0;
+        int add(int v) { return total += v; }
+        int peek(int v) const { return total + v; }
+        void bump(int v) { total += v; }
+    };
+    static_assert(sizeof(Delegate<int(int)>) <= 4 * sizeof(void *) + sizeof(std::function<int(int)>),
+                  "object, member pointer, stub and the std::function fallback");
+
+    Counter counter;
+    Delegate<int(int)> add(&counter, &Counter::add);
+    Delegate<int(int)> peek(static_cast<Counter const *>(&counter), &Counter::peek);
+    Delegate<int(int)> twice(&delegate_twice);
+    Delegate<int(int)> stateless([](int v) { return -v; });
+    CHECK_EQ(add(3), 3);
+    CHECK_EQ(peek(1), 4);
+    CHECK_EQ(twice(5), 10);
+    CHECK_EQ(stateless(7), -7);
+
+    Delegate<int(int)> copy = add;
+    CHECK_EQ(copy(2), 5);
+    CHECK_EQ(counter.total, 5);
+
+    // a capturing lambda that does not fit is copied with the delegate, like a std::function
+    std::string prefix = "a long enough string to defeat the small string buffer";
+    Delegate<int(int)> heap([prefix, calls = 0](int v) mutable { return (int)prefix.size() + v + calls++; });
+    CHECK_EQ(heap(0), (int)prefix.size());
+    Delegate<int(int)> copied = heap;
+    CHECK_EQ(heap(0), (int)prefix.size() + 1);
+    CHECK_EQ(copied(0), (int)prefix.size() + 1);
+    Delegate<int(int)> moved = std::move(heap);
+    CHECK_FALSE(heap);
+    CHECK_EQ(moved(0), (int)prefix.size() + 2);
+    moved = nullptr;
+    CHECK_FALSE(moved);
+    CHECK_EQ(copied(0), (int)prefix.size() + 2);
+
+    // null targets make an empty delegate rather than one that crashes when called
+    int (*none)(int) = nullptr;
+    CHECK_FALSE(Delegate<int(int)>(none));
+    CHECK_FALSE(Delegate<int(int)>(&counter, static_cast<int (Counter::*)(int)>(nullptr)));
+    CHECK_FALSE(Delegate<int(int)>(static_cast<Counter *>(nullptr), &Counter::add));
+    CHECK_FALSE(Delegate<int(int)>(std::function<int(int)>()));
+    CHECK_FALSE(Delegate<int(Counter *, int)>(static_cast<int (Counter::*)(int)>(nullptr)));
+    CHECK_EQ(Delegate<int(Counter *, int)>(&Counter::peek)(&counter, 1), 6);
+
+    // Signal takes member and free functions without wrapping them
+    Signal<int> signal;
+    signal.connect_member(&counter, &Counter::bump);
+    signal.connect(&delegate_twice);
+    signal.emit(10);
+    CHECK_EQ(counter.total, 15);
+}
+
+TEST_CASE("handycpp::signal_slot storage") {
+    Signal<int> signal;
+    std::vector<int> calls;
+    int a = signal.connect([&](int v) { calls.push_back(v); });
+    int b = signal.connect([&](int v) { calls.push_back(v * 10); });
+    int c = 0;
+    c = signal.connect([&](int v) {
+        calls.push_back(v * 100);
+        signal.disconnect(c); // disconnecting itself while it runs
+        signal.connect([&](int w) { calls.push_back(-w); }); // first called by the next emit
+    });
+
+    signal.emit(1);
+    CHECK_EQ(calls, (std::vector<int>{1, 10, 100}));
+    calls.clear();
+    signal.emit(2);
+    CHECK_EQ(calls, (std::vector<int>{2, 20, -2})); // connection order survives compaction
+    calls.clear();
+
+    signal.emit_for(b, 3);
+    signal.emit_for(c, 3); // stale id, nothing happens
+    signal.emit_for_all_but_one(a, 4);
+    CHECK_EQ(calls, (std::vector<int>{30, 40, -4}));
+    calls.clear();
+
+    signal.disconnect(a);
+    signal.disconnect(a);
+    int d = signal.connect([&](int v) { calls.push_back(v + 1000); });
+    CHECK_GT(d, c); // ids are never reused
+    signal.emit(5);
+    CHECK_EQ(calls, (std::vector<int>{50, -5, 1005}));
+    calls.clear();
+
+    signal.connect([&](int) { signal.disconnect_all(); });
+    signal.emit(6);
+    signal.emit(7);
+    CHECK_EQ(calls, (std::vector<int>{60, -6, 1006}));
+}
+
+TEST_CASE("handycpp::signal_slot concurrent") {
+    ConcurrentSignal<int &> signal;
+    std::atomic<bool> stop{false};
+    std::vector<std::thread> emitters;
+    for (int i = 0; i < 2; i++) {
+        emitters.emplace_back([&] {
+            while (!stop.load()) {
+                int calls = 0;
+                signal.emit(calls);
+            }
+        });
+    }
+
+    // subscribe and unsubscribe while emits are running, a slot is never called after disconnect() returns
+    for (int round = 0; round < 200; round++) {
+        auto calls = std::make_shared<std::atomic<int>>(0);
+        auto alive = std::make_shared<std::atomic<bool>>(true);
+        int id = signal.connect([calls, alive](int &) {
+            CHECK(alive->load());
+            (*calls)++;
+        });
+        std::this_thread::yield();
+        signal.disconnect(id);
+        alive->store(false);
+    }
+    stop = true;
+    for (auto &emitter : emitters) {
+        emitter.join();
+    }
+
+    // connect and disconnect from inside a slot, the running emit keeps its snapshot
+    std::vector<int> seen;
+    int self = 0;
+    self = signal.connect([&](int &v) {
+        seen.push_back(v);
+        signal.disconnect(self);
+        signal.connect([&](int &w) { seen.push_back(-w); });
+    });
+    int value = 1;
+    signal.emit(value);
+    value = 2;
+    signal.emit(value);
+    CHECK_EQ(seen, (std::vector<int>{1, -2}));
+
+    int other = signal.connect([&](int &v) { seen.push_back(v * 10); });
+    seen.clear();
+    signal.emit_for(other, value);
+    signal.emit_for_all_but_one(other, value);
+    CHECK_EQ(seen, (std::vector<int>{20, -2}));
+    signal.disconnect_all();
+    signal.emit(value);
+    CHECK_EQ(seen.size(), 2u);
+
+    // a slot on another thread connects while a writer waits for that very emit to finish
+    std::promise<void> inSlot;
+    std::atomic<bool> connected{false};
+    int waiting = signal.connect([&](int &) {
+        if (connected.load()) {
+            return;
+        }
+        inSlot.set_value();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20)); // the writer is waiting by now
+        signal.connect([](int &) {});
+        connected = true;
+    });
+    std::thread emitter([&] {
+        int v = 0;
+        signal.emit(v);
+    });
+    inSlot.get_future().wait();
+    signal.disconnect(waiting);
+    emitter.join();
+    CHECK(connected.load());
+
+    // rvalue reference arguments are moved into every direct slot in turn
+    ConcurrentSignal<std::string &&> moving;
+    std::vector<std::string> got;
+    moving.connect([&](std::string &&s) { got.push_back(std::move(s)); });
+    moving.connect([&](std::string &&s) { got.push_back(s); });
+    moving.emit(std::string("moved"));
+    REQUIRE_EQ(got.size(), 2u);
+    CHECK_EQ(got[0], "moved"); // the second slot gets what the first left behind
+}
+
+TEST_CASE("handycpp::signal_slot queued connections") {
+    EventLoop::Options options;
+    options.threadless = true; // poll() tells how many tasks an emit posted
+    EventLoop first(options);
+    EventLoop second(options);
+
+    Signal<std::string> signal;
+    std::vector<std::string> calls;
+    int a = signal.connect([&](std::string const &v) { calls.push_back("a" + v); }, &first);
+    int b = signal.connect([&](std::string const &v) { calls.push_back("b" + v); }, &first);
+    signal.connect([&](std::string const &v) { calls.push_back("c" + v); }, &second);
+    signal.connect([&](std::string const &v) { calls.push_back("direct" + v); });
+
+    signal.emit("1");
+    CHECK_EQ(calls, (std::vector<std::string>{"direct1"}));
+    CHECK_EQ(first.poll(), 1u); // both slots of a loop share one task
+    CHECK_EQ(second.poll(), 1u);
+    CHECK_EQ(calls, (std::vector<std::string>{"direct1", "a1", "b1", "c1"}));
+    calls.clear();
+
+    signal.emit_for_all_but_one(a, "2");
+    signal.emit_for(a, "3");
+    CHECK_EQ(first.poll(), 2u);
+    second.poll();
+    CHECK_EQ(calls, (std::vector<std::string>{"direct2", "b2", "a3", "c2"}));
+    calls.clear();
+
+    signal.disconnect(b);
+    signal.emit("4");
+    first.poll();
+    signal.disconnect_all();
+    signal.emit("5");
+    CHECK_EQ(first.poll(), 0u);
+    second.poll();
+    CHECK_EQ(calls, (std::vector<std::string>{"direct4", "a4", "c4"}));
+
+    ConcurrentSignal<int> concurrent;
+    int sum = 0;
+    concurrent.connect([&](int v) { sum += v; }, &first);
+    concurrent.connect([&](int v) { sum += v * 10; }, &first);
+    concurrent.emit(2);
+    CHECK_EQ(first.poll(), 1u);
+    CHECK_EQ(sum, 22);
+
+    // a slow queued slot is reported from the emit that posted it
+    std::vector<EventLoop::SlowTask> slow;
+    std::mutex slowMutex;
+    EventLoop::Options watched = options;
+    watched.slowTaskThreshold = std::chrono::milliseconds(10);
+    watched.onSlowTask = [&](EventLoop::SlowTask const &task) {
+        std::lock_guard<std::mutex> guard(slowMutex);
+        slow.push_back(task);
+    };
+    EventLoop third(watched);
+    Signal<int> sleepy;
+    int id = sleepy.connect([](int ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }, &third);
+    int emitLine = __LINE__ + 1;
+    sleepy.emit(50);
+    int emitForLine = __LINE__ + 1;
+    sleepy.emit_for(id, 50);
+    third.poll();
+    std::lock_guard<std::mutex> guard(slowMutex);
+    REQUIRE_EQ(slow.size(), 2u);
+    CHECK_EQ(slow[0].site.line, emitLine);
+    CHECK_EQ(slow[1].site.line, emitForLine);
+}
+
+TEST_CASE("handycpp::signal_slot latest connections") {
+    EventLoop::Options options;
+    options.threadless = true;
+    EventLoop loop(options);
+
+    Signal<int> signal;
+    std::vector<int> every, latest;
+    signal.connect([&](int v) { every.push_back(v); }, &loop);
+    int id = signal.connect(
+        [&](int v) {
+            latest.push_back(v);
+            if (v == 100) {
+                signal.emit(101); // arrives while the delivery runs, gets one more task
+            }
+        },
+        &loop, handycpp::Queued::Latest);
+
+    for (int i = 1; i <= 100; i++) {
+        signal.emit(i);
+    }
+    CHECK_EQ(loop.poll(), 101u); // one task per emit for Every, a single one for Latest
+    CHECK_EQ(every.size(), 100u);
+    CHECK_EQ(latest, (std::vector<int>{100}));
+    CHECK_EQ(loop.poll(), 2u);
+    CHECK_EQ(latest, (std::vector<int>{100, 101}));
+    CHECK_EQ(loop.poll(), 0u); // nothing newer, nothing in flight
+
+    signal.emit_for(id, 7);
+    signal.emit_for(id, 8);
+    loop.poll();
+    CHECK_EQ(latest, (std::vector<int>{100, 101, 8}));
+
+    signal.emit(9);
+    signal.disconnect(id); // drops what is still pending
+    loop.poll();
+    CHECK_EQ(latest.back(), 8);
+    CHECK_EQ(every.back(), 9);
+
+    // many producers, one consumer that always ends up with the newest value
+    EventLoop consumer;
+    ConcurrentSignal<int> concurrent;
+    std::atomic<int> delivered{0}, last{0};
+    concurrent.connect(
+        [&](int v) {
+            delivered++;
+            last = v;
+        },
+        &consumer, handycpp::Queued::Latest);
+    std::vector<std::thread> producers;
+    for (int p = 0; p < 4; p++) {
+        producers.emplace_back([&] {
+            for (int i = 0; i < 1000; i++) {
+                concurrent.emit(i);
+            }
+        });
+    }
+    for (auto &producer : producers) {
+        producer.join();
+    }
+    concurrent.emit(-1);
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+    while (last.load() != -1 && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    CHECK_EQ(last.load(), -1);
+    CHECK_LE(delivered.load(), 4001);
+
+    // a delivery task dropped by a bounded loop does not block later ones
+    EventLoop::Options bounded = options;
+    bounded.capacity = 1;
+    bounded.overflow = EventLoop::Overflow::DropNewest;
+    EventLoop small(bounded);
+    Signal<int> sensor;
+    std::vector<int> readings;
+    sensor.connect([&](int v) { readings.push_back(v); }, &small, handycpp::Queued::Latest);
+    small.enqueue([] {}); // fills the queue, the first delivery task is dropped
+    sensor.emit(1);
+    CHECK_EQ(small.poll(), 1u);
+    sensor.emit(2);
+    CHECK_EQ(small.poll(), 1u);
+    CHECK_EQ(readings, (std::vector<int>{2}));
+}
+
 class MyThread : public EventLoop {
 public:
     int ret;
@@ -0,0 +1,346 @@
+//
+// Created by zhangfuwen on 2026/10/17.
+//
+
+#ifndef HANDYCPP_TASK_GRAPH_H
+#define HANDYCPP_TASK_GRAPH_H
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <future>
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "handycpp/event_loop.h"
+
+/**
+ * a DAG of tasks that run on EventLoop or EventLoopPool workers as soon as their inputs are ready.
+ *
+ * add() takes a callable and the tasks it depends on. the callable gets a reference to the result of each dependency
+ * that produces one, in the order they were listed, so intermediate results are never copied; a consumer that is the
+ * only reader may move out of its argument. independent branches overlap by themselves, and when a task finishes it
+ * goes straight on with one of the tasks it made ready instead of queueing it, as long as both run on the same
+ * executor.
+ *
+ * tasks run on the executor given to run() unless they were pinned to another one with addOn(). a task that throws
+ * skips everything downstream of it, run() rethrows the first exception in the order the tasks were added, and get()
+ * on an affected task rethrows too. the graph can be run again, which clears the previous results.
+ *
+ * @example
+ * \code{.cpp}
+ * handycpp::TaskGraph graph;
+ * auto bytes  = graph.add([&] { return readFile(path); });
+ * auto image  = graph.add([](std::string &b) { return decode(b); }, bytes);
+ * auto thumb  = graph.add([](Image &img) { return scale(img, 128); }, image);
+ * auto gray   = graph.add([](Image &img) { return grayscale(img); }, image);
+ * graph.addOn(ioLoop, [&](Image &t, Image &g) { write(t); write(g); }, thumb, gray);
+ * graph.run(pool); // thumb and gray run at the same time
+ * \endcode
+ */
+namespace handycpp {
+
+class TaskGraph {
+    struct NodeBase;
+    template <typename T> struct Node;
+
+public:
+    using callable_t = MoveOnlyFunction<void()>;
+
+    /**
+     * handle to a task in the graph, cheap to copy. T is what the task returns.
+     */
+    template <typename T> class Task {
+    public:
+        Task() = default;
+
+        /**
+         * the result of the last run, valid until the graph runs again or is destroyed
+         */
+        std::add_lvalue_reference_t<T> get() const {
+            if (m_node->error) {
+                std::rethrow_exception(m_node->error);
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return *m_node->value;
+            }
+        }
+
+    private:
+        friend class TaskGraph;
+        explicit Task(Node<T> *node) : m_node(node) {}
+        Node<T> *m_node = nullptr;
+    };
+
+    TaskGraph() = default;
+    TaskGraph(const TaskGraph &) = delete;
+    TaskGraph &operator=(const TaskGraph &) = delete;
+
+    template <typename Func, typename... Deps> auto add(Func &&func, Task<Deps>... deps) {
+        return addNode(Post{}, std::forward<Func>(func), deps...);
+    }
+
+    /**
+     * same as add(), but the task always runs on executor, e.g. the loop that owns a socket or a database
+     */
+    template <typename Executor, typename Func, typename... Deps>
+    auto addOn(Executor &executor, Func &&func, Task<Deps>... deps) {
+        return addNode(postTo(executor), std::forward<Func>(func), deps...);
+    }
+
+    /**
+     * starts the graph and returns right away, the future is ready once every task has run or been skipped.
+     * the graph must not be modified, run or destroyed before then.
+     */
+    template <typename Executor> std::future<void> launch(Executor &executor) {
+        m_default = postTo(executor);
+        m_done = std::promise<void>();
+        auto future = m_done.get_future();
+        if (m_nodes.empty()) {
+            m_done.set_value();
+            return future;
+        }
+
+        m_unfinished.store(m_nodes.size(), std::memory_order_relaxed);
+        std::vector<NodeBase *> roots;
+        for (auto &node : m_nodes) {
+            node->reset(node->pinned.target != nullptr ? node->pinned : m_default);
+            if (node->dependencies.empty()) {
+                roots.push_back(node.get());
+            }
+        }
+        for (NodeBase *root : roots) {
+            schedule(root);
+        }
+        return future;
+    }
+
+    /**
+     * launch() and wait, rethrows the first exception a task threw. must not be called from a thread the graph
+     * needs, e.g. the only thread of the EventLoop it runs on.
+     */
+    template <typename Executor> void run(Executor &executor) { launch(executor).get(); }
+
+    size_t size() const { return m_nodes.size(); }
+
+private:
+    // type-erased executor: anything with enqueue(callable_t &&)
+    struct Post {
+        void *target = nullptr;
+        void (*post)(void *, callable_t &&) = nullptr;
+        bool operator==(const Post &other) const { return target == other.target; }
+    };
+
+    template <typename Executor> static Post postTo(Executor &executor) {
+        return {&executor, [](void *target, callable_t &&task) {
+                    static_cast<Executor *>(target)->enqueue(std::move(task));
+                }};
+    }
+
+    struct NodeBase {
+        virtual ~NodeBase() = default;
+        virtual void clearResult() = 0;
+        virtual void invoke() = 0; // computes the result, or records the error of a failed dependency or its own
+
+        void reset(Post executor) {
+            clearResult();
+            error = nullptr;
+            post = executor;
+            remaining.store(dependencies.size(), std::memory_order_relaxed);
+        }
+
+        std::vector<NodeBase *> dependencies;
+        std::vector<NodeBase *> dependents;
+        std::atomic<size_t> remaining{0};
+        Post pinned;
+        Post post; // the executor of the current run
+        std::exception_ptr error;
+    };
+
+    template <typename T> struct Node : NodeBase {
+        void clearResult() override {
+            if constexpr (!std::is_void_v<T>) {
+                value.reset();
+            }
+        }
+        std::optional<std::conditional_t<std::is_void_v<T>, bool, T>> value;
+    };
+
+    template <typename T, typename Func, typename... Deps> struct FuncNode : Node<T> {
+        template <typename F>
+        FuncNode(F &&func, Node<Deps> *...deps) : func(std::forward<F>(func)), inputs(deps...) {}
+
+        void invoke() override {
+            for (NodeBase *dependency : this->dependencies) {
+                if (dependency->error) {
+                    this->error = dependency->error;
+                    return;
+                }
+            }
+            try {
+                if constexpr (std::is_void_v<T>) {
+                    std::apply(func, arguments());
+                } else {
+                    this->value.emplace(std::apply(func, arguments()));
+                }
+            } catch (...) {
+                this->error = std::current_exception();
+            }
+        }
+
+        auto arguments() {
+            return std::apply([](auto *...node) { return std::tuple_cat(argumentOf(node)...); }, inputs);
+        }
+
+        Func func;
+        std::tuple<Node<Deps> *...> inputs;
+    };
+
+    // void dependencies only order the graph, they do not show up in the argument list
+    template <typename T> static auto argumentOf(Node<T> *node) {
+        if constexpr (std::is_void_v<T>) {
+            (void)node;
+            return std::tuple<>();
+        } else {
+            return std::tuple<T &>(*node->value);
+        }
+    }
+
+    template <typename Func, typename... Deps> auto addNode(Post pinned, Func &&func, Task<Deps>... deps) {
+        using func_type = std::decay_t<Func>;
+        using args_type = decltype(std::tuple_cat(argumentOf(std::declval<Node<Deps> *>())...));
+        using result_type = decltype(std::apply(std::declval<func_type &>(), std::declval<args_type>()));
+
+        auto node = std::make_unique<FuncNode<result_type, func_type, Deps...>>(std::forward<Func>(func), deps.m_node...);
+        node->pinned = pinned;
+        node->dependencies = {static_cast<NodeBase *>(deps.m_node)...};
+        for (NodeBase *dependency : node->dependencies) {
+            dependency->dependents.push_back(node.get());
+        }
+        Task<result_type> task(node.get());
+        m_nodes.push_back(std::move(node));
+        return task;
+    }
+
+    void schedule(NodeBase *node) {
+        node->post.post(node->post.target, [this, node] { execute(node); });
+    }
+
+    // runs node, then keeps going with a dependent it made ready on the same executor, the rest are posted
+    void execute(NodeBase *node) noexcept {
+        while (node != nullptr) {
+            node->invoke();
+            NodeBase *next = nullptr;
+            for (NodeBase *dependent : node->dependents) {
+                if (dependent->remaining.fetch_sub(1, std::memory_order_acq_rel) != 1) {
+                    continue;
+                }
+                if (next == nullptr && dependent->post == node->post) {
+                    next = dependent;
+                } else {
+                    schedule(dependent);
+                }
+            }
+            if (m_unfinished.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                finish(); // next is always null here, the graph may be gone once finish() returns
+            }
+            node = next;
+        }
+    }
+
+    void finish() noexcept {
+        for (auto &node : m_nodes) {
+            if (node->error) {
+                m_done.set_exception(node->error);
+                return;
+            }
+        }
+        m_done.set_value();
+    }
+
+    std::vector<std::unique_ptr<NodeBase>> m_nodes;
+    Post m_default;
+    std::atomic<size_t> m_unfinished{0};
+    std::promise<void> m_done;
+};
+
+} // namespace handycpp
+
+#ifdef HANDYCPP_TEST
+#include <string>
+#include "handycpp/event_loop_pool.h"
+#include "doctest/doctest.h"
+
+TEST_CASE("handycpp::task_graph") {
+    EventLoopPool pool(4);
+    EventLoop writer;
+
+    struct Blob {
+        explicit Blob(std::string data) : data(std::move(data)) {}
+        Blob(const Blob &) = delete; // intermediate results are never copied
+        Blob(Blob &&) = default;
+        std::string data;
+    };
+
+    std::atomic<int> concurrent{0};
+    std::atomic<int> overlapped{0};
+    auto branch = [&](const Blob &in, const char *suffix) {
+        if (++concurrent > 1) {
+            overlapped++;
+        }
+        auto deadline = std::chrono::steady_clock::now() + std::chrono::milliseconds(200);
+        while (overlapped.load() == 0 && std::chrono::steady_clock::now() < deadline) {
+            std::this_thread::yield();
+        }
+        concurrent--;
+        return Blob(in.data + suffix);
+    };
+
+    handycpp::TaskGraph graph;
+    auto read = graph.add([] { return Blob("raw"); });
+    auto decode = graph.add([](Blob &raw) { return Blob(raw.data + ">decoded"); }, read);
+    auto left = graph.add([&](Blob &in) { return branch(in, ">left"); }, decode);
+    auto right = graph.add([&](Blob &in) { return branch(in, ">right"); }, decode);
+    std::thread::id writtenOn;
+    auto write = graph.addOn(
+        writer,
+        [&](Blob &l, Blob &r) {
+            writtenOn = std::this_thread::get_id();
+            return l.data.size() + r.data.size();
+        },
+        left,
+        right);
+    auto flushed = graph.add([](size_t &) {}, write);
+    int after = 0;
+    graph.add([&] { after++; }, flushed); // void results only order the graph
+    CHECK_EQ(graph.size(), 7u);
+
+    graph.run(pool);
+    CHECK_EQ(left.get().data, "raw>decoded>left");
+    CHECK_EQ(right.get().data, "raw>decoded>right");
+    CHECK_EQ(write.get(), left.get().data.size() + right.get().data.size());
+    CHECK_EQ(writtenOn, writer.enqueueSync([] { return std::this_thread::get_id(); }));
+    CHECK_EQ(overlapped.load(), 1);
+    CHECK_EQ(after, 1);
+
+    // a failure skips everything downstream and is rethrown by run()
+    handycpp::TaskGraph failing;
+    int ranAfterFailure = 0;
+    auto source = failing.add([]() -> int { throw std::runtime_error("boom"); });
+    auto sink = failing.add([&](int &v) { ranAfterFailure++; return v; }, source);
+    auto unrelated = failing.add([] { return 1; });
+    CHECK_THROWS_AS(failing.run(pool), std::runtime_error);
+    CHECK_THROWS_AS(sink.get(), std::runtime_error);
+    CHECK_EQ(unrelated.get(), 1);
+    CHECK_EQ(ranAfterFailure, 0);
+
+    // graphs can be run again
+    graph.run(writer);
+    CHECK_EQ(after, 2);
+}
+#endif
+
+#endif // HANDYCPP_TASK_GRAPH_H